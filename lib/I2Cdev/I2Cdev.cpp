@@ -31,40 +31,454 @@ THE SOFTWARE.
 ===============================================
 */
 
-#include <esp_log.h>
-#include <esp_err.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include "sdkconfig.h"
+#include <stdio.h>
+#include <string.h>
 
 #include "I2Cdev.h"
-
-#define I2C_NUM I2C_NUM_0
-
-#undef ESP_ERROR_CHECK
-#define ESP_ERROR_CHECK(x)   do { esp_err_t rc = (x); if (rc != ESP_OK) { ESP_LOGE("err", "esp_err_t = %d", rc); /*assert(0 && #x);*/} } while(0);
+#include "I2CdevBus.h"
 
 /** Default constructor.
  */
 I2Cdev::I2Cdev() {
 }
 
-/** Initialize I2C0
+/** Default timeout value for read operations.
+ */
+uint16_t I2Cdev::readTimeout = I2CDEV_DEFAULT_READ_TIMEOUT;
+
+/** Bus backend all transactions go through.
+ * Defaults to I2C_NUM_0 through the ESP-IDF driver on the ESP32; off-target
+ * builds have no default and must call setBus() first.
+ */
+#ifdef ESP_PLATFORM
+static I2CdevEspBus espBus(I2C_NUM_0);
+#if SOC_I2C_NUM > 1
+static I2CdevEspBus espBus1(I2C_NUM_1);
+#endif
+I2CdevBus *I2Cdev::bus = &espBus;
+
+static I2CdevEspBus *espBusFor(i2c_port_t port) {
+	if (port == I2C_NUM_0) return &espBus;
+#if SOC_I2C_NUM > 1
+	if (port == I2C_NUM_1) return &espBus1;
+#endif
+	return NULL;
+}
+#else
+I2CdevBus *I2Cdev::bus = NULL;
+#endif
+
+/** Select the bus backend used by all I2Cdev transactions.
+ * @param newBus Bus backend (must outlive its use)
+ */
+void I2Cdev::setBus(I2CdevBus *newBus) {
+    bus = newBus;
+}
+
+/** Get the bus backend used by all I2Cdev transactions.
+ */
+I2CdevBus *I2Cdev::getBus() {
+    return bus;
+}
+
+/** Wait for a number of milliseconds on the current bus's clock.
+ * @param ms Milliseconds to wait
+ * @see I2CdevBus::delay()
  */
-void I2Cdev::initialize() {
+void I2Cdev::delay(uint32_t ms) {
+    bus->delay(ms);
+}
 
+/** Get a microsecond timestamp on the current bus's clock.
+ * @see I2CdevBus::micros()
+ */
+uint32_t I2Cdev::micros() {
+    return bus->micros();
 }
 
+#ifdef ESP_PLATFORM
+/** Install the I2C master driver and route all transactions through it.
+ * @param port I2C port (I2C_NUM_0 or I2C_NUM_1)
+ * @param sda SDA pin
+ * @param scl SCL pin
+ * @param clockHz Bus clock in Hz, up to I2CDEV_MAX_CLOCK (1 MHz Fast-mode Plus)
+ * @return Status of operation (true = success)
+ */
+bool I2Cdev::initialize(i2c_port_t port, gpio_num_t sda, gpio_num_t scl, uint32_t clockHz) {
+	I2CdevEspBus *esp = espBusFor(port);
+	if (esp == NULL || !esp->begin(sda, scl, clockHz)) return false;
+	bus = esp;
+	return true;
+}
+#endif
+
 /** Enable or disable I2C
+ * Releases the bus hardware (the ESP-IDF driver and its pins) or reinstalls
+ * it with the configuration given to initialize().
  * @param isEnabled true = enable, false = disable
  */
 void I2Cdev::enable(bool isEnabled) {
-  
+	bus->enable(isEnabled);
 }
 
-/** Default timeout value for read operations.
+/** Change the clock of the current bus.
+ * @param clockHz Bus clock in Hz, up to I2CDEV_MAX_CLOCK
+ * @return Status of operation (false = not supported by the backend or out of range)
  */
-uint16_t I2Cdev::readTimeout = I2CDEV_DEFAULT_READ_TIMEOUT;
+bool I2Cdev::setClock(uint32_t clockHz) {
+	return bus->setClock(clockHz);
+}
+
+/** Measure the average time of a register read on the current bus.
+ * Run it once per candidate clock (see setClock()) to see what a faster bus
+ * buys in loop time, e.g. with the DMP packet size on FIFO_R_W before the
+ * FIFO is enabled.
+ * @param devAddr I2C slave device address
+ * @param regAddr First register to read from
+ * @param length Number of bytes per read
+ * @param iterations Number of reads to average over
+ * @return Average microseconds per read (0 if any read failed)
+ */
+uint32_t I2Cdev::benchmarkRead(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t iterations) {
+	uint8_t data[255];
+	uint32_t errorsBefore = errors;
+	uint32_t start = micros();
+	for (uint16_t i = 0; i < iterations; i++) {
+		readBytes(devAddr, regAddr, length, data);
+	}
+	uint32_t elapsed = micros() - start;
+	if (errors != errorsBefore || iterations == 0) return 0;
+	return elapsed / iterations;
+}
+
+/** Command link allocation counters.
+ * staticLinks counts links built in a static slot. heapAllocations only moves
+ * when a link had to come from the heap (every slot busy, or a driver
+ * without static link support); in the steady-state balance loop it should
+ * stay flat.
+ */
+uint32_t I2Cdev::staticLinks = 0;
+uint32_t I2Cdev::heapAllocations = 0;
+
+/** Reset the command link allocation counters.
+ */
+void I2Cdev::resetAllocationCounters() {
+	staticLinks = 0;
+	heapAllocations = 0;
+}
+
+
+/** Transaction error counters.
+ * errors counts every failed transaction; the others break it down by cause.
+ * consecutiveErrors is cleared by the next successful transaction, so a
+ * caller can tell a glitch from a bus that is down. Updated from whichever
+ * task ran the transaction, read from any.
+ */
+volatile uint32_t I2Cdev::errors = 0;
+volatile uint32_t I2Cdev::nackErrors = 0;
+volatile uint32_t I2Cdev::timeoutErrors = 0;
+volatile uint32_t I2Cdev::busErrors = 0;
+volatile uint32_t I2Cdev::busRecoveries = 0;
+volatile uint8_t I2Cdev::consecutiveErrors = 0;
+
+/** Reset the transaction error counters.
+ */
+void I2Cdev::resetErrorCounters() {
+	errors = 0;
+	nackErrors = 0;
+	timeoutErrors = 0;
+	busErrors = 0;
+	busRecoveries = 0;
+	consecutiveErrors = 0;
+}
+
+/** Account the outcome of a bus transaction.
+ * A timeout or bus error can leave a slave holding SDA or the controller in
+ * a bad state, so the bus is recovered right away; a NACK only means the
+ * device did not answer and needs no recovery. Nothing is retried here, so
+ * the cost of a failure stays bounded by the transaction deadline plus one
+ * recovery.
+ * @param status I2CDEV_OK or one of the I2CDEV_ERR_* codes
+ * @return status, unchanged
+ */
+int8_t I2Cdev::recordResult(int8_t status) {
+	if (status == I2CDEV_OK) {
+		consecutiveErrors = 0;
+		return status;
+	}
+
+	errors++;
+	if (consecutiveErrors < 255) consecutiveErrors++;
+	switch (status) {
+		case I2CDEV_ERR_NACK: nackErrors++; return status;
+		case I2CDEV_ERR_TIMEOUT: timeoutErrors++; break;
+		default: busErrors++; break;
+	}
+	if (bus->recover()) busRecoveries++;
+	return status;
+}
+
+#ifdef I2CDEV_TRACE
+
+/** Transactions not traced because every trace slot was taken.
+ */
+uint32_t I2Cdev::traceDropped = 0;
+
+static I2CdevTraceStats traceSlots[I2CDEV_TRACE_SLOTS];
+static uint8_t traceUsed = 0;
+
+// Transactions run on TaskPID while the network task reads the slots from
+// the other core
+#ifdef ESP_PLATFORM
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+#define I2CDEV_TRACE_LOCK() portENTER_CRITICAL(&traceLock)
+#define I2CDEV_TRACE_UNLOCK() portEXIT_CRITICAL(&traceLock)
+#else
+#define I2CDEV_TRACE_LOCK()
+#define I2CDEV_TRACE_UNLOCK()
+#endif
+
+static void traceRecord(uint8_t devAddr, uint8_t regAddr, bool write, uint8_t length, int8_t status, uint32_t us) {
+	uint8_t bucket = 0;
+	while (bucket < I2CDEV_TRACE_BUCKETS - 1 && (us >> bucket) != 0) bucket++;
+
+	I2CDEV_TRACE_LOCK();
+	I2CdevTraceStats *slot = NULL;
+	for (uint8_t i = 0; i < traceUsed; i++) {
+		if (traceSlots[i].devAddr == devAddr && traceSlots[i].regAddr == regAddr && traceSlots[i].write == write) {
+			slot = &traceSlots[i];
+			break;
+		}
+	}
+	if (slot == NULL && traceUsed < I2CDEV_TRACE_SLOTS) {
+		slot = &traceSlots[traceUsed++];
+		memset(slot, 0, sizeof(I2CdevTraceStats));
+		slot->devAddr = devAddr;
+		slot->regAddr = regAddr;
+		slot->write = write;
+		slot->minUs = UINT32_MAX;
+	}
+	if (slot == NULL) {
+		I2Cdev::traceDropped++;
+	} else {
+		slot->count++;
+		if (status != I2CDEV_OK) slot->errors++;
+		else slot->bytes += length;
+		if (us < slot->minUs) slot->minUs = us;
+		if (us > slot->maxUs) slot->maxUs = us;
+		slot->totalUs += us;
+		slot->histogram[bucket]++;
+	}
+	I2CDEV_TRACE_UNLOCK();
+}
+
+/** Copy the transaction trace.
+ * Slots are in the order their key was first seen.
+ * @param stats Array to copy into
+ * @param maxEntries Size of stats
+ * @return Number of entries copied
+ */
+uint8_t I2Cdev::traceSnapshot(I2CdevTraceStats *stats, uint8_t maxEntries) {
+	I2CDEV_TRACE_LOCK();
+	uint8_t n = traceUsed < maxEntries ? traceUsed : maxEntries;
+	memcpy(stats, traceSlots, n * sizeof(I2CdevTraceStats));
+	I2CDEV_TRACE_UNLOCK();
+	return n;
+}
+
+/** Format the transaction trace as JSON.
+ * {"dropped":n,"entries":[{"dev":..,"reg":..,"dir":"r"|"w","count":..,
+ * "errors":..,"bytes":..,"min":..,"avg":..,"max":..,"hist":[..]},..]}, times
+ * in microseconds. Entries are copied out one at a time, so the trace keeps
+ * running while it is formatted.
+ * @param buf Output buffer (I2CDEV_TRACE_DUMP_SIZE always fits)
+ * @param size Size of buf
+ * @return Length of the text (0 if it did not fit, buf is then empty)
+ */
+size_t I2Cdev::traceDump(char *buf, size_t size) {
+	size_t len = 0;
+	int n;
+
+#define I2CDEV_TRACE_PRINT(...) do { \
+		n = snprintf(buf + len, size - len, __VA_ARGS__); \
+		if (n < 0 || (size_t)n >= size - len) goto overflow; \
+		len += n; \
+	} while (0)
+
+	if (size == 0) return 0;
+	I2CDEV_TRACE_PRINT("{\"dropped\":%lu,\"entries\":[", (unsigned long)traceDropped);
+	for (uint8_t i = 0; i < I2CDEV_TRACE_SLOTS; i++) {
+		I2CdevTraceStats entry;
+		I2CDEV_TRACE_LOCK();
+		bool used = i < traceUsed;
+		if (used) entry = traceSlots[i];
+		I2CDEV_TRACE_UNLOCK();
+		if (!used) break;
+
+		I2CDEV_TRACE_PRINT("%s{\"dev\":%u,\"reg\":%u,\"dir\":\"%c\",\"count\":%lu,\"errors\":%lu,\"bytes\":%lu,\"min\":%lu,\"avg\":%lu,\"max\":%lu,\"hist\":[",
+			i ? "," : "", entry.devAddr, entry.regAddr, entry.write ? 'w' : 'r',
+			(unsigned long)entry.count, (unsigned long)entry.errors, (unsigned long)entry.bytes,
+			(unsigned long)entry.minUs, (unsigned long)(entry.totalUs / entry.count), (unsigned long)entry.maxUs);
+		for (uint8_t b = 0; b < I2CDEV_TRACE_BUCKETS; b++) {
+			I2CDEV_TRACE_PRINT("%s%lu", b ? "," : "", (unsigned long)entry.histogram[b]);
+		}
+		I2CDEV_TRACE_PRINT("]}");
+	}
+	I2CDEV_TRACE_PRINT("]}");
+	return len;
+
+overflow:
+	buf[0] = '\0';
+	return 0;
+#undef I2CDEV_TRACE_PRINT
+}
+
+/** Clear the transaction trace.
+ */
+void I2Cdev::traceReset() {
+	I2CDEV_TRACE_LOCK();
+	traceUsed = 0;
+	traceDropped = 0;
+	I2CDEV_TRACE_UNLOCK();
+}
+
+#endif /* I2CDEV_TRACE */
+
+/** Run a register read on the current bus and account its outcome.
+ * Every transaction goes through here or busWrite(), which is where error
+ * counting and (with I2CDEV_TRACE) tracing hook in.
+ */
+int8_t I2Cdev::busRead(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+#ifdef I2CDEV_TRACE
+	uint32_t start = bus->micros();
+	int8_t status = bus->read(devAddr, regAddr, length, data, timeout);
+	traceRecord(devAddr, regAddr, false, length, status, bus->micros() - start);
+	return recordResult(status);
+#else
+	return recordResult(bus->read(devAddr, regAddr, length, data, timeout));
+#endif
+}
+
+/** Run a register write on the current bus and account its outcome.
+ * @see busRead()
+ */
+int8_t I2Cdev::busWrite(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout) {
+#ifdef I2CDEV_TRACE
+	uint32_t start = bus->micros();
+	int8_t status = bus->write(devAddr, regAddr, length, data, timeout);
+	traceRecord(devAddr, regAddr, true, length, status, bus->micros() - start);
+	return recordResult(status);
+#else
+	return recordResult(bus->write(devAddr, regAddr, length, data, timeout));
+#endif
+}
+
+/** Number of read-modify-write cycles served from the register shadow.
+ */
+uint32_t I2Cdev::shadowHits = 0;
+
+struct I2CdevShadow {
+	uint8_t devAddr;
+	bool enabled;
+	uint8_t known[32];
+	uint8_t value[256];
+	uint8_t volatileBits[256];
+};
+
+static I2CdevShadow shadows[I2CDEV_SHADOW_DEVICES];
+
+static I2CdevShadow *findShadow(uint8_t devAddr) {
+	for (uint8_t i = 0; i < I2CDEV_SHADOW_DEVICES; i++) {
+		if (shadows[i].enabled && shadows[i].devAddr == devAddr) return &shadows[i];
+	}
+	return NULL;
+}
+
+/** Enable or disable the register shadow of a device.
+ * The shadow remembers the last value written to (or read from) each register
+ * with a single-byte transfer, so writeBit()/writeBits() can skip the read half
+ * of their read-modify-write. It starts out empty; registers that the device
+ * changes on its own must be declared with setShadowVolatileBits().
+ * @param devAddr I2C slave device address
+ * @param enabled true = enable, false = disable
+ * @return Status of operation (false = no free shadow slot)
+ */
+bool I2Cdev::setShadowEnabled(uint8_t devAddr, bool enabled) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (!enabled) {
+		if (shadow != NULL) shadow->enabled = false;
+		return true;
+	}
+	if (shadow != NULL) return true;
+
+	for (uint8_t i = 0; i < I2CDEV_SHADOW_DEVICES; i++) {
+		if (!shadows[i].enabled) {
+			memset(&shadows[i], 0, sizeof(I2CdevShadow));
+			shadows[i].devAddr = devAddr;
+			shadows[i].enabled = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Mark register bits the device may change on its own.
+ * Volatile bits are never remembered (self-clearing reset strobes, status
+ * flags); a mask of 0xFF keeps the register out of the shadow entirely.
+ * @param devAddr I2C slave device address
+ * @param regAddr Register address
+ * @param mask Volatile bit mask
+ */
+void I2Cdev::setShadowVolatileBits(uint8_t devAddr, uint8_t regAddr, uint8_t mask) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (shadow == NULL) return;
+	shadow->volatileBits[regAddr] = mask;
+	shadow->known[regAddr >> 3] &= ~(1 << (regAddr & 7));
+}
+
+/** Forget every remembered register value of a device.
+ * Call after anything that resets the device behind the driver's back.
+ * @param devAddr I2C slave device address
+ */
+void I2Cdev::invalidateShadow(uint8_t devAddr) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (shadow == NULL) return;
+	memset(shadow->known, 0, sizeof(shadow->known));
+}
+
+void I2Cdev::shadowStore(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (shadow == NULL || shadow->volatileBits[regAddr] == 0xFF) return;
+	shadow->value[regAddr] = data & ~shadow->volatileBits[regAddr];
+	shadow->known[regAddr >> 3] |= (1 << (regAddr & 7));
+}
+
+void I2Cdev::shadowForget(uint8_t devAddr, uint8_t regAddr, uint8_t length) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (shadow == NULL) return;
+	for (uint16_t reg = regAddr; reg < (uint16_t)regAddr + length && reg < 256; reg++) {
+		shadow->known[reg >> 3] &= ~(1 << (reg & 7));
+	}
+}
+
+/** Get the current value of a register for a read-modify-write.
+ * Served from the shadow when the value is known, read from the device
+ * otherwise.
+ * @param devAddr I2C slave device address
+ * @param regAddr Register address
+ * @param data Container for byte value
+ * @return Status of operation (true = success)
+ */
+bool I2Cdev::readShadowed(uint8_t devAddr, uint8_t regAddr, uint8_t *data) {
+	I2CdevShadow *shadow = findShadow(devAddr);
+	if (shadow != NULL && (shadow->known[regAddr >> 3] & (1 << (regAddr & 7)))) {
+		*data = shadow->value[regAddr];
+		shadowHits++;
+		return true;
+	}
+	return readByte(devAddr, regAddr, data) > 0;
+}
+
 /** Read a single bit from an 8-bit device register.
  * @param devAddr I2C slave device address
  * @param regAddr Register regAddr to read from
@@ -77,8 +491,8 @@ int8_t I2Cdev::readBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t
 
 
 	uint8_t b;
-    uint8_t count = readByte(devAddr, regAddr, &b, timeout);
-    *data = b & (1 << bitNum);
+    int8_t count = readByte(devAddr, regAddr, &b, timeout);
+    if (count > 0) *data = b & (1 << bitNum);
     return count;
 }
 
@@ -97,8 +511,9 @@ int8_t I2Cdev::readBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint
     //    xxx   args: bitStart=4, length=3
     //    010   masked
     //   -> 010 shifted
-    uint8_t count, b;
-    if ((count = readByte(devAddr, regAddr, &b, timeout)) != 0) {
+    int8_t count;
+    uint8_t b;
+    if ((count = readByte(devAddr, regAddr, &b, timeout)) > 0) {
         uint8_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         b &= mask;
         b >>= (bitStart - length + 1);
@@ -119,29 +534,21 @@ int8_t I2Cdev::readByte(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uint16_
 }
 
 /** Read multiple bytes from an 8-bit device register.
+ * The register pointer write and the data read are issued as one combined
+ * transaction (START, addr+W, reg, repeated START, addr+R, data, STOP), so the
+ * bus is set up and released once per call instead of twice.
  * @param devAddr I2C slave device address
  * @param regAddr First register regAddr to read from
  * @param length Number of bytes to read
  * @param data Buffer to store read data in
  * @param timeout Optional read timeout in milliseconds (0 to disable, leave off to use default class value in I2Cdev::readTimeout)
- * @return I2C_TransferReturn_TypeDef http://downloads.energymicro.com/documentation/doxygen/group__I2C.html
+ * @return Number of bytes read (-1 indicates failure, data is then undefined)
  */
 int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
-	i2c_cmd_handle_t cmd;
-	SelectRegister(devAddr, regAddr);
-
-	cmd = i2c_cmd_link_create();
-	ESP_ERROR_CHECK(i2c_master_start(cmd));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_READ, 1));
+	int8_t status = busRead(devAddr, regAddr, length, data, timeout);
 
-	if(length>1)
-		ESP_ERROR_CHECK(i2c_master_read(cmd, data, length-1, I2C_MASTER_ACK));
-
-	ESP_ERROR_CHECK(i2c_master_read_byte(cmd, data+length-1, I2C_MASTER_NACK));
-
-	ESP_ERROR_CHECK(i2c_master_stop(cmd));
-	ESP_ERROR_CHECK(i2c_master_cmd_begin(I2C_NUM, cmd, 1000/portTICK_PERIOD_MS));
-	i2c_cmd_link_delete(cmd);
+	if (status != I2CDEV_OK) return -1;
+	if (length == 1) shadowStore(devAddr, regAddr, *data);
 
 	return length;
 }
@@ -149,20 +556,17 @@ int8_t I2Cdev::readBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8
 bool I2Cdev::writeWord(uint8_t devAddr, uint8_t regAddr, uint16_t data){
 
 	uint8_t data1[] = {(uint8_t)(data>>8), (uint8_t)(data & 0xff)};
-	writeBytes(devAddr, regAddr, 2, data1);
-	return true;
+	return writeBytes(devAddr, regAddr, 2, data1);
 }
 
+/** Set the register pointer of a device without transferring data.
+ * Kept for callers that need a bare pointer write; register reads no longer
+ * go through here (see readBytes()).
+ * @param dev I2C slave device address
+ * @param reg Register address to select
+ */
 void I2Cdev::SelectRegister(uint8_t dev, uint8_t reg){
-	i2c_cmd_handle_t cmd;
-
-	cmd = i2c_cmd_link_create();
-	ESP_ERROR_CHECK(i2c_master_start(cmd));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, (dev << 1) | I2C_MASTER_WRITE, 1));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, reg, 1));
-	ESP_ERROR_CHECK(i2c_master_stop(cmd));
-	ESP_ERROR_CHECK(i2c_master_cmd_begin(I2C_NUM, cmd, 1000/portTICK_PERIOD_MS));
-	i2c_cmd_link_delete(cmd);
+	busWrite(dev, reg, 0, NULL, readTimeout);
 }
 
 /** write a single bit in an 8-bit device register.
@@ -173,8 +577,8 @@ void I2Cdev::SelectRegister(uint8_t dev, uint8_t reg){
  * @return Status of operation (true = success)
  */
 bool I2Cdev::writeBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t data) {
-    uint8_t b;
-    readByte(devAddr, regAddr, &b);
+    uint8_t b = 0;
+    readShadowed(devAddr, regAddr, &b);
     b = (data != 0) ? (b | (1 << bitNum)) : (b & ~(1 << bitNum));
     return writeByte(devAddr, regAddr, b);
 }
@@ -196,7 +600,7 @@ bool I2Cdev::writeBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint8
     // 10100011 original & ~mask
     // 10101011 masked | value
     uint8_t b = 0;
-    if (readByte(devAddr, regAddr, &b) != 0) {
+    if (readShadowed(devAddr, regAddr, &b)) {
         uint8_t mask = ((1 << length) - 1) << (bitStart - length + 1);
         data <<= (bitStart - length + 1); // shift data into correct position
         data &= mask; // zero all non-important bits in data
@@ -215,18 +619,12 @@ bool I2Cdev::writeBits(uint8_t devAddr, uint8_t regAddr, uint8_t bitStart, uint8
  * @return Status of operation (true = success)
  */
 bool I2Cdev::writeByte(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
-	i2c_cmd_handle_t cmd;
+	int8_t status = busWrite(devAddr, regAddr, 1, &data, readTimeout);
 
-	cmd = i2c_cmd_link_create();
-	ESP_ERROR_CHECK(i2c_master_start(cmd));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, 1));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, regAddr, 1));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, data, 1));
-	ESP_ERROR_CHECK(i2c_master_stop(cmd));
-	ESP_ERROR_CHECK(i2c_master_cmd_begin(I2C_NUM, cmd, 1000/portTICK_PERIOD_MS));
-	i2c_cmd_link_delete(cmd);
+	if (status == I2CDEV_OK) shadowStore(devAddr, regAddr, data);
+	else shadowForget(devAddr, regAddr, 1);
 
-	return true;
+	return status == I2CDEV_OK;
 }
 
 /** Write single byte to an 8-bit device register.
@@ -237,18 +635,11 @@ bool I2Cdev::writeByte(uint8_t devAddr, uint8_t regAddr, uint8_t data) {
  * @return Status of operation (true = success)
  */
 bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data){
-	i2c_cmd_handle_t cmd;
-
-	cmd = i2c_cmd_link_create();
-	ESP_ERROR_CHECK(i2c_master_start(cmd));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, 1));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, regAddr, 1));
-	ESP_ERROR_CHECK(i2c_master_write(cmd, data, length-1, 0));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, data[length-1], 1));
-	ESP_ERROR_CHECK(i2c_master_stop(cmd));
-	ESP_ERROR_CHECK(i2c_master_cmd_begin(I2C_NUM, cmd, 1000/portTICK_PERIOD_MS));
-	i2c_cmd_link_delete(cmd);
-	return true;
+	int8_t status = busWrite(devAddr, regAddr, length, data, readTimeout);
+
+	// burst writes may target auto-incrementing or FIFO-style registers
+	shadowForget(devAddr, regAddr, length);
+	return status == I2CDEV_OK;
 }
 
 
@@ -262,9 +653,8 @@ bool I2Cdev::writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_
  */
 int8_t I2Cdev::readWord(uint8_t devAddr, uint8_t regAddr, uint16_t *data, uint16_t timeout){
 	uint8_t msb[2] = {0,0};
-	readBytes(devAddr, regAddr, 2, msb);
-	*data = (int16_t)((msb[0] << 8) | msb[1]);
-	return 0;
+	int8_t count = readBytes(devAddr, regAddr, 2, msb, timeout);
+	if (count > 0) *data = (int16_t)((msb[0] << 8) | msb[1]);
+	return count;
 }
 
-
@@ -34,7 +34,26 @@ THE SOFTWARE.
 #ifndef _I2CDEV_H_
 #define _I2CDEV_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
 #include <driver/i2c.h>
+#include <esp_idf_version.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+// Off-target builds (Linux host): the drivers only need a millisecond delay
+// from FreeRTOS, which is routed to the bus backend (see I2Cdev::delay()).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+typedef uint32_t TickType_t;
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#endif
+
+class I2CdevBus;
 
 #define I2C_SDA_PORT gpioPortA
 #define I2C_SDA_PIN 0
@@ -46,14 +65,75 @@ THE SOFTWARE.
 #define I2C_SCL_MODE gpioModeWiredAnd
 #define I2C_SCL_DOUT 1
 
-#define I2CDEV_DEFAULT_READ_TIMEOUT 1000
+// Per-transaction deadline in milliseconds, on top of the time the transfer
+// needs on the wire at the configured clock. It only expires on a misbehaving
+// bus, and bounds how long one glitch can hold TaskPID.
+#define I2CDEV_DEFAULT_READ_TIMEOUT 10
+
+// Bus clock used by initialize() when none is given
+#define I2CDEV_DEFAULT_CLOCK 400000
+
+// Command links are built in static slots instead of on the heap when the
+// driver supports it (ESP-IDF 4.4+). A link is rebuilt for every transaction
+// (it points at the caller's buffer), so the slots are a plain pool: one per
+// transaction that can be in flight at once. Only one task (setup, then
+// TaskPID) drives the bus today; the spare slots let a device on another
+// task share it without falling back to the heap. A register read (pointer write +
+// repeated-start read) is the largest transaction we build.
+#ifdef ESP_PLATFORM
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#define I2CDEV_STATIC_CMD_LINKS
+#endif
+#endif
+#define I2CDEV_CMD_SLOTS 4
+#define I2CDEV_CMD_LINK_TRANSACTIONS 2
+
+// Number of devices that can have a register shadow (see setShadowEnabled())
+#define I2CDEV_SHADOW_DEVICES 2
+
+// Transaction tracing (see I2Cdev::traceDump()). When I2CDEV_TRACE is defined
+// every transaction is timed and accounted per (device, register, direction)
+// in one of I2CDEV_TRACE_SLOTS slots; without it the hooks compile away.
+// Histogram bucket b counts transactions that took less than 2^b us (the
+// last bucket takes everything slower).
+// #define I2CDEV_TRACE
+#ifndef I2CDEV_TRACE_SLOTS
+#define I2CDEV_TRACE_SLOTS 16
+#endif
+#define I2CDEV_TRACE_BUCKETS 16
+// Buffer size that always holds a full traceDump()
+#define I2CDEV_TRACE_DUMP_SIZE (64 + I2CDEV_TRACE_SLOTS * 320)
+
+#ifdef I2CDEV_TRACE
+struct I2CdevTraceStats {
+    uint8_t devAddr;
+    uint8_t regAddr;
+    bool write;
+    uint32_t count;
+    uint32_t errors;
+    uint32_t bytes;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+    uint32_t histogram[I2CDEV_TRACE_BUCKETS];
+};
+#endif
 
 class I2Cdev {
     public:
         I2Cdev();
 
-        static void initialize();
+#ifdef ESP_PLATFORM
+        static bool initialize(i2c_port_t port, gpio_num_t sda, gpio_num_t scl, uint32_t clockHz=I2CDEV_DEFAULT_CLOCK);
+#endif
         static void enable(bool isEnabled);
+        static bool setClock(uint32_t clockHz);
+        static uint32_t benchmarkRead(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t iterations);
+
+        static void setBus(I2CdevBus *newBus);
+        static I2CdevBus *getBus();
+        static void delay(uint32_t ms);
+        static uint32_t micros();
 
         static int8_t readBit(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint8_t *data, uint16_t timeout=I2Cdev::readTimeout);
         //TODO static int8_t readBitW(uint8_t devAddr, uint8_t regAddr, uint8_t bitNum, uint16_t *data, uint16_t timeout=I2Cdev::readTimeout);
@@ -73,11 +153,51 @@ class I2Cdev {
         static bool writeBytes(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data);
         //TODO static bool writeWords(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint16_t *data);
 
+        static bool setShadowEnabled(uint8_t devAddr, bool enabled);
+        static void setShadowVolatileBits(uint8_t devAddr, uint8_t regAddr, uint8_t mask);
+        static void invalidateShadow(uint8_t devAddr);
+
         static uint16_t readTimeout;
 
+        // command link allocation counters (see I2CdevEspBus::acquireCmd())
+        static uint32_t staticLinks;
+        static uint32_t heapAllocations;
+        static void resetAllocationCounters();
+
+        static uint32_t shadowHits;
+
+        // transaction error counters (see recordResult())
+        static volatile uint32_t errors;
+        static volatile uint32_t nackErrors;
+        static volatile uint32_t timeoutErrors;
+        static volatile uint32_t busErrors;
+        static volatile uint32_t busRecoveries;
+        static volatile uint8_t consecutiveErrors;
+        static void resetErrorCounters();
+
+#ifdef I2CDEV_TRACE
+        static uint8_t traceSnapshot(I2CdevTraceStats *stats, uint8_t maxEntries);
+        static size_t traceDump(char *buf, size_t size);
+        static void traceReset();
+        static uint32_t traceDropped;
+#endif
+
     //private:
         static void SelectRegister(uint8_t dev, uint8_t reg);
+        static bool readShadowed(uint8_t devAddr, uint8_t regAddr, uint8_t *data);
+        static void shadowStore(uint8_t devAddr, uint8_t regAddr, uint8_t data);
+        static void shadowForget(uint8_t devAddr, uint8_t regAddr, uint8_t length);
+        static int8_t recordResult(int8_t status);
+        static int8_t busRead(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout);
+        static int8_t busWrite(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout);
+        static I2CdevBus *bus;
         //static I2C_TransferReturn_TypeDef transfer(I2C_TransferSeq_TypeDef *seq, uint16_t timeout=I2Cdev::readTimeout);
 };
 
+#ifndef ESP_PLATFORM
+inline void vTaskDelay(TickType_t ticks) {
+    I2Cdev::delay(ticks * portTICK_PERIOD_MS);
+}
+#endif
+
 #endif /* _I2CDEV_H_ */
@@ -0,0 +1,175 @@
+// I2Cdev library collection - I2C bus backends
+// Transport layer behind the I2Cdev register helpers. I2Cdev talks to the bus
+// through I2CdevBus only, so the device drivers on top of it run unchanged on
+// the ESP32 (ESP-IDF driver), on a Linux host (i2c-dev) or against an
+// in-process device emulator.
+
+/* ============================================
+I2Cdev device library code is placed under the MIT license
+Copyright (c) 2015 Jeff Rowberg, Nicolas Baldeck
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+#ifndef _I2CDEVBUS_H_
+#define _I2CDEVBUS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include <driver/i2c.h>
+#include <driver/gpio.h>
+#endif
+
+// Transaction status codes returned by I2CdevBus::read()/write()
+#define I2CDEV_OK           0
+#define I2CDEV_ERR_NACK     -1 // device did not acknowledge
+#define I2CDEV_ERR_TIMEOUT  -2 // transaction did not finish in time
+#define I2CDEV_ERR_BUS      -3 // bus busy, arbitration lost or driver failure
+
+// Highest bus clock the backends accept (Fast-mode Plus). Above 400 kHz the
+// internal pull-ups are far too weak; use external ones sized for the bus.
+#define I2CDEV_MAX_CLOCK    1000000
+
+class I2CdevBus {
+    public:
+        virtual ~I2CdevBus() {}
+
+        /** Read from consecutive device registers.
+         * Register pointer write and data read in one repeated-start transaction.
+         * @param devAddr I2C slave device address
+         * @param regAddr First register to read from
+         * @param length Number of bytes to read (at least 1)
+         * @param data Buffer to store read data in
+         * @param timeout Transaction timeout in milliseconds
+         * @return I2CDEV_OK or one of the I2CDEV_ERR_* codes
+         */
+        virtual int8_t read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) = 0;
+
+        /** Write to consecutive device registers.
+         * @param devAddr I2C slave device address
+         * @param regAddr First register to write to
+         * @param length Number of bytes to write (0 = only set the register pointer)
+         * @param data Bytes to write
+         * @param timeout Transaction timeout in milliseconds
+         * @return I2CDEV_OK or one of the I2CDEV_ERR_* codes
+         */
+        virtual int8_t write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout) = 0;
+
+        /** Wait for a number of milliseconds in the bus's notion of time.
+         * Device drivers use this for power-up and reset delays, so an emulated
+         * bus can advance its own clock instead of sleeping.
+         * @param ms Milliseconds to wait
+         */
+        virtual void delay(uint32_t ms) = 0;
+
+        /** Get a free-running microsecond timestamp in the bus's notion of time.
+         * Used to time driver operations, so an emulated bus reports
+         * simulated time.
+         * @return Microseconds since an arbitrary epoch (wraps at 2^32)
+         */
+        virtual uint32_t micros() = 0;
+
+        /** Try to bring a misbehaving bus back to idle.
+         * Called by I2Cdev after a transaction timed out or failed with a bus
+         * error. Must return within a bounded time; the default does nothing.
+         * @return true if the bus is idle afterwards
+         */
+        virtual bool recover() { return false; }
+
+        /** Change the bus clock.
+         * @param clockHz Bus clock in Hz
+         * @return true if the backend applied it
+         */
+        virtual bool setClock(uint32_t clockHz) { (void)clockHz; return false; }
+
+        /** Release or re-acquire the bus hardware.
+         * @param isEnabled true = enable, false = disable
+         * @return true if the bus is in the requested state
+         */
+        virtual bool enable(bool isEnabled) { return isEnabled; }
+};
+
+#ifdef ESP_PLATFORM
+
+/** ESP-IDF legacy I2C master driver backend.
+ * Either installs the driver itself (begin()) or runs on a driver installed
+ * elsewhere; bus recovery and clock changes then need the pins and clock it
+ * was installed with (see configure()).
+ */
+class I2CdevEspBus : public I2CdevBus {
+    public:
+        I2CdevEspBus(i2c_port_t port);
+
+        bool begin(gpio_num_t sda, gpio_num_t scl, uint32_t clockHz);
+        void end();
+        void configure(gpio_num_t sda, gpio_num_t scl, uint32_t clockHz);
+        bool setClock(uint32_t clockHz);
+        uint32_t getClock();
+        bool enable(bool isEnabled);
+
+        int8_t read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout);
+        int8_t write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout);
+        void delay(uint32_t ms);
+        uint32_t micros();
+        bool recover();
+
+        i2c_port_t getPort();
+
+    private:
+        i2c_port_t port;
+        gpio_num_t sda;
+        gpio_num_t scl;
+        uint32_t clockHz;
+        bool installed;
+
+        bool applyConfig();
+
+        static i2c_cmd_handle_t acquireCmd();
+        static void releaseCmd(i2c_cmd_handle_t cmd);
+};
+
+#endif /* ESP_PLATFORM */
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+
+/** Linux i2c-dev backend (/dev/i2c-N), using I2C_RDWR combined transfers.
+ */
+class I2CdevLinuxBus : public I2CdevBus {
+    public:
+        I2CdevLinuxBus();
+        ~I2CdevLinuxBus();
+
+        bool open(const char *path);
+        void close();
+
+        int8_t read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout);
+        int8_t write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout);
+        void delay(uint32_t ms);
+        uint32_t micros();
+
+    private:
+        int fd;
+};
+
+#endif /* __linux__ */
+
+#endif /* _I2CDEVBUS_H_ */
@@ -0,0 +1,333 @@
+// I2Cdev library collection - ESP-IDF I2C bus backend
+// Runs I2Cdev transactions on the ESP-IDF legacy I2C master driver.
+
+/* ============================================
+I2Cdev device library code is placed under the MIT license
+Copyright (c) 2015 Jeff Rowberg, Nicolas Baldeck
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+#ifdef ESP_PLATFORM
+
+#include <esp_err.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "sdkconfig.h"
+
+#include "I2Cdev.h"
+#include "I2CdevBus.h"
+
+// Stop building a command link at the first failure; the error is reported
+// through the transaction status instead of being logged from the hot path.
+#define I2CDEV_TRY(x) do { if (rc == ESP_OK) rc = (x); } while (0)
+
+// Half an SCL period while clocking a stuck slave free (~100 kHz)
+#define I2CDEV_RECOVERY_HALF_PERIOD_US 5
+
+#ifdef I2CDEV_STATIC_CMD_LINKS
+struct I2CdevCmdSlot {
+	bool busy;
+	i2c_cmd_handle_t cmd;
+	uint8_t link[I2C_LINK_RECOMMENDED_SIZE(I2CDEV_CMD_LINK_TRANSACTIONS)];
+};
+
+static I2CdevCmdSlot cmdSlots[I2CDEV_CMD_SLOTS];
+static portMUX_TYPE cmdSlotMux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+/** Map an ESP-IDF error code to an I2CDEV_* status code.
+ */
+static int8_t toStatus(esp_err_t rc) {
+	switch (rc) {
+		case ESP_OK: return I2CDEV_OK;
+		case ESP_FAIL: return I2CDEV_ERR_NACK;
+		case ESP_ERR_TIMEOUT: return I2CDEV_ERR_TIMEOUT;
+		default: return I2CDEV_ERR_BUS;
+	}
+}
+
+/** Convert a transaction timeout to driver ticks.
+ * The timeout is a margin on top of the time the transfer itself needs on
+ * the wire, so long bursts at a slow clock do not expire while healthy.
+ * Rounded up, so a short timeout still waits at least one tick.
+ * @param timeout Timeout in milliseconds (0 = wait forever)
+ * @param length Number of data bytes in the transaction
+ * @param clockHz Bus clock in Hz (0 if unknown)
+ */
+static TickType_t toTicks(uint16_t timeout, uint8_t length, uint32_t clockHz) {
+	if (timeout == 0) return portMAX_DELAY;
+	uint32_t ms = timeout;
+	if (clockHz > 0) ms += (9 * ((uint32_t)length + 3) * 1000 + clockHz - 1) / clockHz;
+	return (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
+
+/** Create a backend for an I2C port.
+ * @param port ESP-IDF I2C port number (driver must be installed on it)
+ */
+I2CdevEspBus::I2CdevEspBus(i2c_port_t port) : port(port), sda(GPIO_NUM_NC), scl(GPIO_NUM_NC), clockHz(0), installed(false) {
+}
+
+/** Install the I2C master driver on this port.
+ * Replaces a driver this backend installed before.
+ * @param sda SDA pin
+ * @param scl SCL pin
+ * @param clockHz Bus clock in Hz (up to I2CDEV_MAX_CLOCK)
+ * @return Status of operation (true = success)
+ */
+bool I2CdevEspBus::begin(gpio_num_t sda, gpio_num_t scl, uint32_t clockHz) {
+	if (clockHz == 0 || clockHz > I2CDEV_MAX_CLOCK) return false;
+	end();
+	configure(sda, scl, clockHz);
+	if (!applyConfig()) return false;
+	installed = i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0) == ESP_OK;
+	return installed;
+}
+
+/** Remove the driver installed by begin(), releasing the pins.
+ */
+void I2CdevEspBus::end() {
+	if (!installed) return;
+	i2c_driver_delete(port);
+	installed = false;
+}
+
+/** Describe how the driver on this port was installed.
+ * Only needed when the driver was installed outside begin(). Without it
+ * recover() can only reset the controller FIFOs.
+ * @param sda SDA pin
+ * @param scl SCL pin
+ * @param clockHz Bus clock in Hz
+ */
+void I2CdevEspBus::configure(gpio_num_t sda, gpio_num_t scl, uint32_t clockHz) {
+	this->sda = sda;
+	this->scl = scl;
+	this->clockHz = clockHz;
+}
+
+/** Change the bus clock of the running driver.
+ * @param clockHz Bus clock in Hz (up to I2CDEV_MAX_CLOCK)
+ * @return Status of operation (false = out of range or pins unknown)
+ */
+bool I2CdevEspBus::setClock(uint32_t clockHz) {
+	if (clockHz == 0 || clockHz > I2CDEV_MAX_CLOCK) return false;
+	if (sda == GPIO_NUM_NC || scl == GPIO_NUM_NC) return false;
+	uint32_t previous = this->clockHz;
+	this->clockHz = clockHz;
+	if (applyConfig()) return true;
+	this->clockHz = previous;
+	return false;
+}
+
+/** Get the configured bus clock in Hz (0 if unknown).
+ */
+uint32_t I2CdevEspBus::getClock() {
+	return clockHz;
+}
+
+/** Remove or reinstall the driver with the configuration given to begin().
+ * @see I2CdevBus::enable()
+ */
+bool I2CdevEspBus::enable(bool isEnabled) {
+	if (!isEnabled) {
+		end();
+		return true;
+	}
+	if (installed) return true;
+	return begin(sda, scl, clockHz);
+}
+
+/** Program pins and clock into the port (driver installed or not).
+ */
+bool I2CdevEspBus::applyConfig() {
+	i2c_config_t conf = {};
+	conf.mode = I2C_MODE_MASTER;
+	conf.sda_io_num = sda;
+	conf.scl_io_num = scl;
+	conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
+	conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
+	conf.master.clk_speed = clockHz;
+	return i2c_param_config(port, &conf) == ESP_OK;
+}
+
+/** Get the I2C port this backend runs on.
+ */
+i2c_port_t I2CdevEspBus::getPort() {
+	return port;
+}
+
+/** Read from consecutive device registers.
+ * START, addr+W, reg, repeated START, addr+R, data, STOP as one command link.
+ * @see I2CdevBus::read()
+ */
+int8_t I2CdevEspBus::read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+	i2c_cmd_handle_t cmd;
+	esp_err_t rc = ESP_OK;
+
+	cmd = acquireCmd();
+	I2CDEV_TRY(i2c_master_start(cmd));
+	I2CDEV_TRY(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, 1));
+	I2CDEV_TRY(i2c_master_write_byte(cmd, regAddr, 1));
+	I2CDEV_TRY(i2c_master_start(cmd));
+	I2CDEV_TRY(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_READ, 1));
+
+	if(length>1)
+		I2CDEV_TRY(i2c_master_read(cmd, data, length-1, I2C_MASTER_ACK));
+
+	I2CDEV_TRY(i2c_master_read_byte(cmd, data+length-1, I2C_MASTER_NACK));
+
+	I2CDEV_TRY(i2c_master_stop(cmd));
+	I2CDEV_TRY(i2c_master_cmd_begin(port, cmd, toTicks(timeout, length, clockHz)));
+	releaseCmd(cmd);
+
+	return toStatus(rc);
+}
+
+/** Write to consecutive device registers.
+ * @see I2CdevBus::write()
+ */
+int8_t I2CdevEspBus::write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout) {
+	i2c_cmd_handle_t cmd;
+	esp_err_t rc = ESP_OK;
+
+	cmd = acquireCmd();
+	I2CDEV_TRY(i2c_master_start(cmd));
+	I2CDEV_TRY(i2c_master_write_byte(cmd, (devAddr << 1) | I2C_MASTER_WRITE, 1));
+	I2CDEV_TRY(i2c_master_write_byte(cmd, regAddr, 1));
+	if (length > 0)
+		I2CDEV_TRY(i2c_master_write(cmd, (uint8_t *)data, length, 1));
+	I2CDEV_TRY(i2c_master_stop(cmd));
+	I2CDEV_TRY(i2c_master_cmd_begin(port, cmd, toTicks(timeout, length, clockHz)));
+	releaseCmd(cmd);
+
+	return toStatus(rc);
+}
+
+/** Block the calling task for a number of milliseconds.
+ */
+void I2CdevEspBus::delay(uint32_t ms) {
+	vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+/** Get the time since boot in microseconds.
+ */
+uint32_t I2CdevEspBus::micros() {
+	return (uint32_t)esp_timer_get_time();
+}
+
+/** Bring a stuck bus back to idle.
+ * A slave that lost clock sync in the middle of a read keeps SDA low until it
+ * has shifted out the rest of its byte. The driver is removed, SCL is clocked
+ * by hand (at most 9 pulses) until the slave releases SDA, a STOP is issued,
+ * and the driver is reinstalled with its original configuration. Takes well
+ * under a millisecond; without configure() only the controller FIFOs are
+ * reset.
+ * @return true if SDA is released and the driver is back up
+ */
+bool I2CdevEspBus::recover() {
+	if (sda == GPIO_NUM_NC || scl == GPIO_NUM_NC) {
+		return i2c_reset_tx_fifo(port) == ESP_OK && i2c_reset_rx_fifo(port) == ESP_OK;
+	}
+
+	i2c_driver_delete(port);
+	installed = false;
+
+	gpio_set_level(sda, 1);
+	gpio_set_level(scl, 1);
+	gpio_set_direction(sda, GPIO_MODE_INPUT_OUTPUT_OD);
+	gpio_set_direction(scl, GPIO_MODE_INPUT_OUTPUT_OD);
+	esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+
+	for (uint8_t i = 0; i < 9 && gpio_get_level(sda) == 0; i++) {
+		gpio_set_level(scl, 0);
+		esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+		gpio_set_level(scl, 1);
+		esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+	}
+
+	// STOP: SDA rises while SCL is high
+	gpio_set_level(scl, 0);
+	esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(sda, 0);
+	esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(scl, 1);
+	esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+	gpio_set_level(sda, 1);
+	esp_rom_delay_us(I2CDEV_RECOVERY_HALF_PERIOD_US);
+	bool released = gpio_get_level(sda) != 0;
+
+	if (!applyConfig()) return false;
+	installed = i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0) == ESP_OK;
+
+	return released && installed;
+}
+
+/** Get an empty command link for a transaction.
+ * Links come from a small pool of static slots, so the hot reads in TaskPID
+ * never touch the heap. The link holds the caller's data pointer and the
+ * driver walks it once, so it is built afresh for every transaction; that is
+ * only a few list appends into the slot buffer.
+ * @return Command link handle, to be handed back through releaseCmd()
+ */
+i2c_cmd_handle_t I2CdevEspBus::acquireCmd() {
+#ifdef I2CDEV_STATIC_CMD_LINKS
+	I2CdevCmdSlot *slot = NULL;
+
+	portENTER_CRITICAL(&cmdSlotMux);
+	for (uint8_t i = 0; i < I2CDEV_CMD_SLOTS; i++) {
+		if (!cmdSlots[i].busy) {
+			slot = &cmdSlots[i];
+			slot->busy = true;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&cmdSlotMux);
+
+	if (slot != NULL) {
+		I2Cdev::staticLinks++;
+		slot->cmd = i2c_cmd_link_create_static(slot->link, sizeof(slot->link));
+		return slot->cmd;
+	}
+#endif
+	I2Cdev::heapAllocations++;
+	return i2c_cmd_link_create();
+}
+
+/** Hand back a command link obtained from acquireCmd().
+ * @param cmd Command link handle
+ */
+void I2CdevEspBus::releaseCmd(i2c_cmd_handle_t cmd) {
+#ifdef I2CDEV_STATIC_CMD_LINKS
+	for (uint8_t i = 0; i < I2CDEV_CMD_SLOTS; i++) {
+		if (cmdSlots[i].busy && cmdSlots[i].cmd == cmd) {
+			i2c_cmd_link_delete_static(cmd);
+			portENTER_CRITICAL(&cmdSlotMux);
+			cmdSlots[i].busy = false;
+			portEXIT_CRITICAL(&cmdSlotMux);
+			return;
+		}
+	}
+#endif
+	i2c_cmd_link_delete(cmd);
+}
+
+#endif /* ESP_PLATFORM */
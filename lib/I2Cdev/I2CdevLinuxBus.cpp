@@ -0,0 +1,138 @@
+// I2Cdev library collection - Linux i2c-dev bus backend
+// Runs I2Cdev transactions on a Linux I2C adapter (/dev/i2c-N), e.g. a
+// Raspberry Pi or a USB-I2C bridge, for driver bring-up and throughput tests
+// off the ESP32.
+
+/* ============================================
+I2Cdev device library code is placed under the MIT license
+Copyright (c) 2015 Jeff Rowberg, Nicolas Baldeck
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "I2CdevBus.h"
+
+/** Map an errno from an I2C_RDWR ioctl to an I2CDEV_* status code.
+ */
+static int8_t toStatus(int err) {
+    switch (err) {
+        case ENXIO:
+        case EREMOTEIO: return I2CDEV_ERR_NACK;
+        case ETIMEDOUT: return I2CDEV_ERR_TIMEOUT;
+        default: return I2CDEV_ERR_BUS;
+    }
+}
+
+I2CdevLinuxBus::I2CdevLinuxBus() : fd(-1) {
+}
+
+I2CdevLinuxBus::~I2CdevLinuxBus() {
+    close();
+}
+
+/** Open an i2c-dev adapter.
+ * @param path Adapter device node, e.g. "/dev/i2c-1"
+ * @return Status of operation (true = success)
+ */
+bool I2CdevLinuxBus::open(const char *path) {
+    close();
+    fd = ::open(path, O_RDWR);
+    return fd >= 0;
+}
+
+/** Close the adapter, if open.
+ */
+void I2CdevLinuxBus::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+/** Read from consecutive device registers.
+ * Register pointer write and data read go out as one I2C_RDWR request, which
+ * the adapter issues with a repeated START between them.
+ * @see I2CdevBus::read()
+ */
+int8_t I2CdevLinuxBus::read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+    if (fd < 0) return I2CDEV_ERR_BUS;
+
+    struct i2c_msg msgs[2];
+    msgs[0].addr = devAddr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &regAddr;
+    msgs[1].addr = devAddr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = length;
+    msgs[1].buf = data;
+
+    struct i2c_rdwr_ioctl_data xfer = {msgs, 2};
+    ioctl(fd, I2C_TIMEOUT, (timeout + 9) / 10); // adapter timeout is in units of 10 ms
+    if (ioctl(fd, I2C_RDWR, &xfer) < 0) return toStatus(errno);
+    return I2CDEV_OK;
+}
+
+/** Write to consecutive device registers.
+ * @see I2CdevBus::write()
+ */
+int8_t I2CdevLinuxBus::write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout) {
+    if (fd < 0) return I2CDEV_ERR_BUS;
+
+    uint8_t buf[1 + 255];
+    buf[0] = regAddr;
+    if (length > 0) memcpy(buf + 1, data, length);
+
+    struct i2c_msg msg;
+    msg.addr = devAddr;
+    msg.flags = 0;
+    msg.len = 1 + length;
+    msg.buf = buf;
+
+    struct i2c_rdwr_ioctl_data xfer = {&msg, 1};
+    ioctl(fd, I2C_TIMEOUT, (timeout + 9) / 10);
+    if (ioctl(fd, I2C_RDWR, &xfer) < 0) return toStatus(errno);
+    return I2CDEV_OK;
+}
+
+/** Sleep for a number of milliseconds.
+ */
+void I2CdevLinuxBus::delay(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+/** Get CLOCK_MONOTONIC in microseconds.
+ */
+uint32_t I2CdevLinuxBus::micros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+#endif /* __linux__ */
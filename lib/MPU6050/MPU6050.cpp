@@ -36,26 +36,10 @@ THE SOFTWARE.
 
 #include "MPU6050.h"
 #include <string.h>
-
-#define I2C_NUM I2C_NUM_0
+#include <math.h>
 
 void MPU6050::ReadRegister(uint8_t reg, uint8_t *data, uint8_t len){
-	uint8_t dev = 0x68;
-	i2c_cmd_handle_t cmd;
-	I2Cdev::SelectRegister(dev, reg);
-
-	cmd = i2c_cmd_link_create();
-	ESP_ERROR_CHECK(i2c_master_start(cmd));
-	ESP_ERROR_CHECK(i2c_master_write_byte(cmd, (dev << 1) | I2C_MASTER_READ, 1));
-
-	if(len>1)
-		ESP_ERROR_CHECK(i2c_master_read(cmd, data, len, I2C_MASTER_ACK));
-
-	ESP_ERROR_CHECK(i2c_master_read_byte(cmd, data+len-1, I2C_MASTER_NACK));
-
-	ESP_ERROR_CHECK(i2c_master_stop(cmd));
-	ESP_ERROR_CHECK(i2c_master_cmd_begin(I2C_NUM, cmd, 1000));
-	i2c_cmd_link_delete(cmd);
+	I2Cdev::readBytes(devAddr, reg, len, data);
 }
 
 
@@ -64,6 +48,10 @@ void MPU6050::ReadRegister(uint8_t reg, uint8_t *data, uint8_t len){
  */
 MPU6050::MPU6050() {
     devAddr = MPU6050_DEFAULT_ADDRESS;
+#ifdef MPU6050_INCLUDE_DMP_MOTIONAPPS20
+    dmpFIFOLayout = MPU6050_DMP_FIFO_LAYOUT;
+    dmpFIFORate = MPU6050_DMP_FIFO_RATE_DIVISOR;
+#endif
 }
 
 /** Specific address constructor.
@@ -74,6 +62,10 @@ MPU6050::MPU6050() {
  */
 MPU6050::MPU6050(uint8_t address) {
     devAddr = address;
+#ifdef MPU6050_INCLUDE_DMP_MOTIONAPPS20
+    dmpFIFOLayout = MPU6050_DMP_FIFO_LAYOUT;
+    dmpFIFORate = MPU6050_DMP_FIFO_RATE_DIVISOR;
+#endif
 }
 
 /** Power on and prepare for general usage.
@@ -98,6 +90,46 @@ bool MPU6050::testConnection() {
     return getDeviceID() == 0x34;
 }
 
+/** Enable or disable the I2Cdev register shadow for this device.
+ * With the shadow enabled, the many bit-level configuration writes (in
+ * dmpInitialize(), setDMPEnabled(), resetFIFO(), ...) cost one bus write
+ * instead of a read followed by a write, once a register's value is known.
+ * Registers and bits the MPU changes on its own (status, sensor data, FIFO,
+ * DMP memory window, self-clearing reset strobes) are kept out of it. The
+ * shadow is dropped on reset().
+ * @param enabled true = enable, false = disable
+ * @return Status of operation (false = no free shadow slot)
+ * @see I2Cdev::setShadowEnabled()
+ */
+bool MPU6050::setRegisterShadowEnabled(bool enabled) {
+    if (!I2Cdev::setShadowEnabled(devAddr, enabled)) return false;
+    if (!enabled) return true;
+
+    // status and data registers
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_I2C_SLV4_DI, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_I2C_MST_STATUS, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_DMP_INT_STATUS, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_INT_STATUS, 0xFF);
+    for (uint8_t reg = MPU6050_RA_ACCEL_XOUT_H; reg <= MPU6050_RA_MOT_DETECT_STATUS; reg++) {
+        I2Cdev::setShadowVolatileBits(devAddr, reg, 0xFF);
+    }
+
+    // DMP memory window (MEM_START_ADDR auto-increments) and FIFO
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_MEM_START_ADDR, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_MEM_R_W, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_FIFO_COUNTH, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_FIFO_COUNTL, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_FIFO_R_W, 0xFF);
+
+    // self-clearing reset strobes
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_SIGNAL_PATH_RESET, 0xFF);
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_USER_CTRL,
+        (1 << MPU6050_USERCTRL_DMP_RESET_BIT) | (1 << MPU6050_USERCTRL_FIFO_RESET_BIT) |
+        (1 << MPU6050_USERCTRL_I2C_MST_RESET_BIT) | (1 << MPU6050_USERCTRL_SIG_COND_RESET_BIT));
+    I2Cdev::setShadowVolatileBits(devAddr, MPU6050_RA_PWR_MGMT_1, 1 << MPU6050_PWR1_DEVICE_RESET_BIT);
+    return true;
+}
+
 // AUX_VDDIO register (InvenSense demo code calls this RA_*G_OFFS_TC)
 
 /** Get the auxiliary I2C supply voltage level.
@@ -2447,6 +2479,7 @@ void MPU6050::resetSensors() {
  */
 void MPU6050::reset() {
     I2Cdev::writeBit(devAddr, MPU6050_RA_PWR_MGMT_1, MPU6050_PWR1_DEVICE_RESET_BIT, true);
+    I2Cdev::invalidateShadow(devAddr); // every register is back to its power-on value
 }
 /** Get sleep mode status.
  * Setting the SLEEP bit in the register puts the device into very low power
@@ -3031,7 +3064,7 @@ void MPU6050::readMemoryBlock(uint8_t *data, uint16_t dataSize, uint8_t bank, ui
     uint8_t chunkSize;
     for (uint16_t i = 0; i < dataSize;) {
         // determine correct chunk size according to bank position and data size
-        chunkSize = MPU6050_DMP_MEMORY_CHUNK_SIZE;
+        chunkSize = MPU6050_DMP_MEMORY_BURST_SIZE;
 
         // make sure we don't go past the data size
         if (i + chunkSize > dataSize) chunkSize = dataSize - i;
@@ -3048,86 +3081,61 @@ void MPU6050::readMemoryBlock(uint8_t *data, uint16_t dataSize, uint8_t bank, ui
         // uint8_t automatically wraps to 0 at 256
         address += chunkSize;
 
-        // if we aren't done, update bank (if necessary) and address
-        if (i < dataSize) {
-            if (address == 0) bank++;
+        // MEM_START_ADDR auto-increments within a bank; only a bank change
+        // needs the pointer set again
+        if (i < dataSize && address == 0) {
+            bank++;
             setMemoryBank(bank);
             setMemoryStartAddress(address);
         }
     }
 }
+/** Write a block of DMP memory, optionally verifying it.
+ * Each bank the block touches is selected once and streamed in
+ * MPU6050_DMP_MEMORY_BURST_SIZE bursts, relying on MEM_START_ADDR
+ * auto-incrementing within the bank. With verify set, the part of the bank
+ * just written is read back once and compared against the source. Program
+ * memory is directly addressable on the ESP32, so useProgMem needs no staging
+ * copy. Nothing is logged, so the caller can time the upload.
+ * @param data Bytes to write
+ * @param dataSize Number of bytes to write
+ * @param bank First memory bank
+ * @param address Start address within the first bank
+ * @param verify Read back and compare each bank after writing it
+ * @param useProgMem Data lives in program memory (no effect on the ESP32)
+ * @return Status of operation (false = bus error or verification mismatch)
+ */
 bool MPU6050::writeMemoryBlock(const uint8_t *data, uint16_t dataSize, uint8_t bank, uint8_t address, bool verify, bool useProgMem) {
-	setMemoryBank(bank);
-	setMemoryStartAddress(address);
-    uint8_t chunkSize;
-    uint8_t *verifyBuffer=0;
-    uint8_t *progBuffer=0;
-    uint16_t i;
-    uint8_t j;
-    if (verify) verifyBuffer = (uint8_t *)malloc(MPU6050_DMP_MEMORY_CHUNK_SIZE);
-    if (useProgMem) progBuffer = (uint8_t *)malloc(MPU6050_DMP_MEMORY_CHUNK_SIZE);
-    for (i = 0; i < dataSize;) {
-        // determine correct chunk size according to bank position and data size
-        chunkSize = MPU6050_DMP_MEMORY_CHUNK_SIZE;
-
-        // make sure we don't go past the data size
-        if (i + chunkSize > dataSize) chunkSize = dataSize - i;
-
-        // make sure this chunk doesn't go past the bank boundary (256 bytes)
-        if (chunkSize > 256 - address) chunkSize = 256 - address;
-        
-        if (useProgMem) {
-            // write the chunk of data as specified
-            for (j = 0; j < chunkSize; j++) progBuffer[j] = pgm_read_byte(data + i + j);
-        } else {
-            // write the chunk of data as specified
-            progBuffer = (uint8_t *)data + i;
+    uint8_t verifyBuffer[MPU6050_DMP_MEMORY_BURST_SIZE];
+    uint16_t i, n, span;
+    uint8_t burst;
+    (void)useProgMem;
+
+    for (i = 0; i < dataSize; i += span) {
+        // the part of the block that lands in this bank
+        span = MPU6050_DMP_MEMORY_BANK_SIZE - address;
+        if (span > dataSize - i) span = dataSize - i;
+
+        setMemoryBank(bank);
+        setMemoryStartAddress(address);
+        for (n = 0; n < span; n += burst) {
+            burst = (span - n > MPU6050_DMP_MEMORY_BURST_SIZE) ? MPU6050_DMP_MEMORY_BURST_SIZE : span - n;
+            if (!I2Cdev::writeBytes(devAddr, MPU6050_RA_MEM_R_W, burst, (uint8_t *)data + i + n)) return false;
         }
 
-        I2Cdev::writeBytes(devAddr, MPU6050_RA_MEM_R_W, chunkSize, progBuffer);
-
-        // verify data if needed
-        if (verify && verifyBuffer) {
-        	printf("VERIFY\n");
-            setMemoryBank(bank);
+        if (verify) {
             setMemoryStartAddress(address);
-            I2Cdev::readBytes(devAddr, MPU6050_RA_MEM_R_W, chunkSize, verifyBuffer);
-            if (memcmp(progBuffer, verifyBuffer, chunkSize) != 0) {
-            	printf("Block write verification error, bank \n");
-                /*Serial.print("Block write verification error, bank ");*/
-                printf("bank %d", bank);
-                printf(", address ");
-                printf("%d", address);
-                printf("!\nExpected:");
-                for (j = 0; j < chunkSize; j++) {
-                    printf("%#04x", progBuffer[j]);
-                }
-                printf("\nReceived:");
-                for (uint8_t j = 0; j < chunkSize; j++) {
-                    printf("%#04x", verifyBuffer[i + j]);
-                }
-                printf("\n");
-                //free(verifyBuffer);
-                //if (useProgMem) free(progBuffer);
-                //return false; // uh oh.
+            for (n = 0; n < span; n += burst) {
+                burst = (span - n > MPU6050_DMP_MEMORY_BURST_SIZE) ? MPU6050_DMP_MEMORY_BURST_SIZE : span - n;
+                // readBytes() returns the length as int8_t, or -1 on failure; a burst is never 255
+                if (I2Cdev::readBytes(devAddr, MPU6050_RA_MEM_R_W, burst, verifyBuffer) != (int8_t)burst) return false;
+                if (memcmp(data + i + n, verifyBuffer, burst) != 0) return false;
             }
         }
 
-        // increase byte index by [chunkSize]
-        i += chunkSize;
-
-        // uint8_t automatically wraps to 0 at 256
-        address += chunkSize;
-
-        // if we aren't done, update bank (if necessary) and address
-        if (i < dataSize) {
-            if (address == 0) bank++;
-            setMemoryBank(bank);
-            setMemoryStartAddress(address);
-        }
+        bank++;
+        address = 0;
     }
-    if (verify) free(verifyBuffer);
-    if (useProgMem) free(progBuffer);
     return true;
 }
 bool MPU6050::writeProgMemoryBlock(const uint8_t *data, uint16_t dataSize, uint8_t bank, uint8_t address, bool verify) {
@@ -3352,4 +3360,99 @@ void MPU6050::PID(uint8_t ReadAddress, float kP,float kI, uint8_t Loops){
     }
     resetFIFO();
     resetDMP();
-}
\ No newline at end of file
+}
+
+/** Find the gyro and/or accel offset registers that zero the sensor output.
+ * Each pass averages a block of samples at the current offsets (the
+ * least-squares estimate of the remaining bias) and steps the offsets by that
+ * bias over the known register gain: 4 LSB per gyro offset count at
+ * +-250 deg/s, 8 LSB per accel offset count at +-2g (bit 0 of the accel
+ * offsets is reserved and kept). Without noise one pass lands within a
+ * register step, so it usually finishes in two or three passes, and it never
+ * runs more than maxPasses: about maxPasses * (samples + 10) ms in all.
+ *
+ * The device is left at +-250 deg/s, +-2g, DLPF 188 Hz and 1 kHz sample rate
+ * with the DMP off; the caller restores its own configuration. The accel
+ * target is +1g on Z, so the board must be flat, Z up, for accel calibration.
+ * @param sensors MPU6050_CALIBRATE_GYRO and/or MPU6050_CALIBRATE_ACCEL
+ * @param samples Samples averaged per pass (1 ms apart)
+ * @param maxPasses Upper bound on the number of passes
+ * @param callback Called after every pass with the offsets and remaining bias, or NULL
+ * @param arg Passed to callback
+ * @return 0 when converged, 1 if still outside tolerance after maxPasses
+ *         (offsets left at the last estimate), 2 on a bus error
+ */
+uint8_t MPU6050::calibrateOffsets(uint8_t sensors, uint16_t samples, uint8_t maxPasses, MPU6050CalibrationCallback callback, void *arg) {
+    uint32_t errorsBefore = I2Cdev::errors;
+    setDMPEnabled(false);
+    setFullScaleGyroRange(MPU6050_GYRO_FS_250);
+    setFullScaleAccelRange(MPU6050_ACCEL_FS_2);
+    setDLPFMode(MPU6050_DLPF_BW_188);
+    setRate(0);
+
+    // ax ay az gx gy gz, in getMotion6() order
+    const int32_t target[6] = {0, 0, 16384, 0, 0, 0};
+    const int16_t gain[6] = {8, 8, 8, 4, 4, 4};
+    const int16_t tolerance[6] = {
+        MPU6050_CALIBRATION_ACCEL_TOLERANCE, MPU6050_CALIBRATION_ACCEL_TOLERANCE, MPU6050_CALIBRATION_ACCEL_TOLERANCE,
+        MPU6050_CALIBRATION_GYRO_TOLERANCE, MPU6050_CALIBRATION_GYRO_TOLERANCE, MPU6050_CALIBRATION_GYRO_TOLERANCE
+    };
+    bool selected[6];
+    MPU6050CalibrationProgress progress;
+    progress.passes = maxPasses;
+    progress.offsets[0] = getXAccelOffset();
+    progress.offsets[1] = getYAccelOffset();
+    progress.offsets[2] = getZAccelOffset();
+    progress.offsets[3] = getXGyroOffset();
+    progress.offsets[4] = getYGyroOffset();
+    progress.offsets[5] = getZGyroOffset();
+    for (uint8_t i = 0; i < 6; i++) {
+        selected[i] = (sensors & (i < 3 ? MPU6050_CALIBRATE_ACCEL : MPU6050_CALIBRATE_GYRO)) != 0;
+        progress.bias[i] = 0;
+    }
+    if (samples == 0) samples = 1;
+
+    for (progress.pass = 1; progress.pass <= maxPasses; progress.pass++) {
+        setXAccelOffset(progress.offsets[0]);
+        setYAccelOffset(progress.offsets[1]);
+        setZAccelOffset(progress.offsets[2]);
+        setXGyroOffset(progress.offsets[3]);
+        setYGyroOffset(progress.offsets[4]);
+        setZGyroOffset(progress.offsets[5]);
+        I2Cdev::delay(MPU6050_CALIBRATION_SETTLE_MS); // flush samples taken at the old offsets
+
+        int32_t sum[6] = {0, 0, 0, 0, 0, 0};
+        for (uint16_t n = 0; n < samples; n++) {
+            int16_t m[6];
+            I2Cdev::delay(1);
+            getMotion6(&m[0], &m[1], &m[2], &m[3], &m[4], &m[5]);
+            for (uint8_t i = 0; i < 6; i++) sum[i] += m[i];
+        }
+        if (I2Cdev::errors != errorsBefore) return 2;
+
+        bool converged = true;
+        for (uint8_t i = 0; i < 6; i++) {
+            progress.bias[i] = (float)sum[i] / samples - target[i];
+            if (!selected[i]) continue;
+            if (fabsf(progress.bias[i]) > tolerance[i]) converged = false;
+        }
+        if (callback) callback(&progress, arg);
+        if (converged) return 0;
+
+        for (uint8_t i = 0; i < 6; i++) {
+            if (!selected[i]) continue;
+            int16_t offset = progress.offsets[i] - (int16_t)roundf(progress.bias[i] / gain[i]);
+            if (i < 3) offset = (offset & 0xFFFE) | (progress.offsets[i] & 1);
+            progress.offsets[i] = offset;
+        }
+    }
+
+    // Out of passes: keep the last step, it is the best estimate there is
+    setXAccelOffset(progress.offsets[0]);
+    setYAccelOffset(progress.offsets[1]);
+    setZAccelOffset(progress.offsets[2]);
+    setXGyroOffset(progress.offsets[3]);
+    setYGyroOffset(progress.offsets[4]);
+    setZGyroOffset(progress.offsets[5]);
+    return I2Cdev::errors != errorsBefore ? 2 : 1;
+}
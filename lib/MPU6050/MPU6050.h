@@ -430,6 +430,57 @@ THE SOFTWARE.
 #define MPU6050_DMP_MEMORY_BANKS        8
 #define MPU6050_DMP_MEMORY_BANK_SIZE    256
 #define MPU6050_DMP_MEMORY_CHUNK_SIZE   16
+#define MPU6050_DMP_MEMORY_BURST_SIZE   128 // bytes per MEM_R_W transfer in block reads/writes (half a bank)
+
+// DMP FIFO packet contents (see dmpSetFIFOLayout()). The quaternion (16 bytes)
+// and the 2-byte footer are always sent; gyro and accel add 12 bytes each.
+// The switches are the inv_send_gyro/inv_send_accel entries of the firmware
+// image, which skip their FIFO write when set to MPU6050_DMP_CFG_DISABLED.
+#define MPU6050_DMP_FIFO_GYRO           0x01
+#define MPU6050_DMP_FIFO_ACCEL          0x02
+#ifndef MPU6050_DMP_FIFO_LAYOUT
+#define MPU6050_DMP_FIFO_LAYOUT         (MPU6050_DMP_FIFO_GYRO | MPU6050_DMP_FIFO_ACCEL)
+#endif
+#define MPU6050_DMP_CFG_GYRO_ADDRESS    0x0747 // CFG_9, 4 bytes
+#define MPU6050_DMP_CFG_ACCEL_ADDRESS   0x076C // CFG_12, 4 bytes
+#define MPU6050_DMP_CFG_DISABLED        0xA3
+#define MPU6050_DMP_QUATERNION_SIZE     16
+#define MPU6050_DMP_VECTOR_SIZE         12
+#define MPU6050_DMP_FOOTER_SIZE         2
+#define MPU6050_DMP_GYRO_LSB_PER_DPS    16.4f // FIFO gyro is at +-2000 deg/s
+
+// DMP output rate (see dmpSetFIFORate()). The DMP samples at 200 Hz (set up
+// with setRate(4)) and sends every (1 + divisor)th sample: 0 = 200 Hz,
+// 1 = 100 Hz, 3 = 50 Hz.
+#define MPU6050_DMP_SAMPLE_RATE         200
+#ifndef MPU6050_DMP_FIFO_RATE_DIVISOR
+#define MPU6050_DMP_FIFO_RATE_DIVISOR   0x00 // The New instance of the Firmware has this as the default
+#endif
+#define MPU6050_DMP_FIFO_RATE_ADDRESS   0x0216 // D_0_22, 2 bytes big-endian
+
+// Offset calibration (see calibrateOffsets()). Tolerances are in output LSBs
+// at +-2g and +-250 deg/s: one accel offset step (0.98 mg) and one gyro step.
+#define MPU6050_CALIBRATE_GYRO                  0x01
+#define MPU6050_CALIBRATE_ACCEL                 0x02
+#define MPU6050_CALIBRATION_SAMPLES             250
+#define MPU6050_CALIBRATION_PASSES              6
+#define MPU6050_CALIBRATION_SETTLE_MS           10
+#define MPU6050_CALIBRATION_ACCEL_TOLERANCE     16
+#define MPU6050_CALIBRATION_GYRO_TOLERANCE      4
+
+// State passed to the calibrateOffsets() progress callback after every pass.
+// offsets[] and bias[] are in getMotion6() order (accel XYZ, gyro XYZ); bias
+// is the mean output minus its target at the offsets used for that pass.
+struct MPU6050CalibrationProgress {
+    uint8_t pass;
+    uint8_t passes;
+    int16_t offsets[6];
+    float bias[6];
+};
+typedef void (*MPU6050CalibrationCallback)(const MPU6050CalibrationProgress *progress, void *arg);
+
+#define MPU6050_FIFO_SIZE               1024
+#define MPU6050_FIFO_BURST_SIZE         252 // bytes per FIFO_R_W transfer when draining (I2Cdev transfers are at most 255)
 
 // note: DMP code memory blocks defined at end of header file
 
@@ -442,6 +493,7 @@ class MPU6050 {
 
         void initialize();
         bool testConnection();
+        bool setRegisterShadowEnabled(bool enabled);
 
         // AUX_VDDIO register
         uint8_t getAuxVDDIOLevel();
@@ -827,8 +879,15 @@ class MPU6050 {
         #ifdef MPU6050_INCLUDE_DMP_MOTIONAPPS20
             uint8_t *dmpPacketBuffer;
             uint16_t dmpPacketSize;
+            uint8_t dmpFIFOLayout;
+            uint8_t dmpFIFORate;
+            uint32_t dmpUploadTime; // microseconds the last firmware upload took
 
             uint8_t dmpInitialize();
+            uint8_t dmpResume();
+            bool dmpSetFIFOLayout(uint8_t layout);
+            uint8_t dmpGetFIFOLayout();
+            bool dmpFirmwarePresent();
             bool dmpPacketAvailable();
 
             uint8_t dmpSetFIFORate(uint8_t fifoRate);
@@ -904,6 +963,8 @@ class MPU6050 {
             
             uint8_t dmpGetEuler(float *data, Quaternion *q);
             uint8_t dmpGetYawPitchRoll(float *data, Quaternion *q, VectorFloat *gravity);
+            uint8_t dmpGetPitch(float *pitch, const uint8_t* packet=0);
+            uint8_t dmpGetPitchRate(float *rate, const uint8_t* packet=0);
 
             // Get Floating Point data from FIFO
             uint8_t dmpGetAccelFloat(float *data, const uint8_t* packet=0);
@@ -911,6 +972,7 @@ class MPU6050 {
 
             uint8_t dmpProcessFIFOPacket(const unsigned char *dmpData);
             uint8_t dmpReadAndProcessFIFOPacket(uint8_t numPackets, uint8_t *processed=NULL);
+            uint8_t dmpGetLatestFIFOPacket(uint8_t *packet, uint16_t *skipped=NULL, uint16_t fifoCount=0);
 
             uint8_t dmpSetFIFOProcessedCallback(void (*func) (void));
 
@@ -1028,6 +1090,8 @@ class MPU6050 {
 
     void CalibrateGyro(uint8_t Loops = 15); // Fine tune after setting offsets with less Loops.
     void CalibrateAccel(uint8_t Loops = 15);// Fine tune after setting offsets with less Loops.
+    uint8_t calibrateOffsets(uint8_t sensors, uint16_t samples=MPU6050_CALIBRATION_SAMPLES, uint8_t maxPasses=MPU6050_CALIBRATION_PASSES,
+                             MPU6050CalibrationCallback callback=NULL, void *arg=NULL);
     void PID(uint8_t ReadAddress, float kP,float kI, uint8_t Loops);  // Does the
 
     private:
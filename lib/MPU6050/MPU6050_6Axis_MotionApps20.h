@@ -35,10 +35,12 @@ THE SOFTWARE.
 
 #include "I2Cdev.h"
 // #include "helper_3dmath.h"
+#ifdef ESP_PLATFORM
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <string.h>
 #include "sdkconfig.h"
+#endif
+#include <string.h>
 
 // MotionApps 2.0 DMP implementation, built using the MPU-6050EVB evaluation board
 #define MPU6050_INCLUDE_DMP_MOTIONAPPS20
@@ -2132,9 +2134,12 @@ const unsigned char dmpUpdates[MPU6050_DMP_UPDATES_SIZE] = {
     0x01, 0x62, 0x02, 0x00, 0x00,
     0x00, 0x60, 0x04, 0x00, 0x40, 0x00, 0x00};
 
-#ifndef MPU6050_DMP_FIFO_RATE_DIVISOR
-#define MPU6050_DMP_FIFO_RATE_DIVISOR 0x00 // The New instance of the Firmware has this as the default
-#endif
+// DMP program start address (DMP_CFG_1/DMP_CFG_2). The image below it is the
+// DMP's working memory, which it rewrites while running; code starts here.
+#define MPU6050_DMP_START_ADDRESS 0x0300
+
+// Bytes compared per code bank when looking for resident firmware
+#define MPU6050_DMP_SIGNATURE_SIZE 16
 
 uint8_t MPU6050::dmpInitialize()
 {
@@ -2196,13 +2201,16 @@ uint8_t MPU6050::dmpInitialize()
     DEBUG_PRINTLN(F("Writing DMP code to MPU memory banks ("));
     DEBUG_PRINT(MPU6050_DMP_CODE_SIZE);
     DEBUG_PRINTLN(F(" bytes)"));
+    uint32_t uploadStart = I2Cdev::micros();
     if (writeProgMemoryBlock(dmpMemory, MPU6050_DMP_CODE_SIZE))
     {
+        dmpUploadTime = I2Cdev::micros() - uploadStart;
         DEBUG_PRINTLN(F("Success! DMP code written and verified."));
+        DEBUG_PRINTLN(F("Upload time (us) = "));
+        DEBUG_PRINT(dmpUploadTime);
 
         // Set the FIFO Rate Divisor int the DMP Firmware Memory
-        unsigned char dmpUpdate[] = {0x00, MPU6050_DMP_FIFO_RATE_DIVISOR};
-        writeMemoryBlock(dmpUpdate, 0x02, 0x02, 0x16); // Lets write the dmpUpdate data to the Firmware image, we have 2 bytes to write in bank 0x02 with the Offset 0x16
+        dmpSetFIFORate(dmpFIFORate);
 
         // write DMP configuration
         // DEBUG_PRINTLN(F("Writing DMP configuration to MPU memory banks ("));
@@ -2232,9 +2240,9 @@ uint8_t MPU6050::dmpInitialize()
 
             DEBUG_PRINTLN(F("Setting DMP programm start address"));
             // write start address MSB into register
-            setDMPConfig1(0x03);
+            setDMPConfig1(MPU6050_DMP_START_ADDRESS >> 8);
             // write start address LSB into register
-            setDMPConfig2(0x00);
+            setDMPConfig2(MPU6050_DMP_START_ADDRESS & 0xFF);
 
             DEBUG_PRINTLN(F("Clearing OTP Bank flag..."));
             setOTPBankValid(false);
@@ -2348,8 +2356,9 @@ uint8_t MPU6050::dmpInitialize()
             DEBUG_PRINTLN(F("Disabling DMP (you turn it on later)..."));
             setDMPEnabled(false);
 
-            DEBUG_PRINTLN(F("Setting up internal 42-byte (default) DMP packet buffer..."));
-            dmpPacketSize = 42;
+            DEBUG_PRINTLN(F("Setting up DMP packet layout..."));
+            if (!dmpSetFIFOLayout(dmpFIFOLayout))
+                return 2; // configuration block loading failed
             /*if ((dmpPacketBuffer = (uint8_t *)malloc(42)) == 0) {
                 return 3; // TODO: proper error code for no memory
             }*/
@@ -2372,15 +2381,168 @@ uint8_t MPU6050::dmpInitialize()
     return 0; // success
 }
 
+/** Check whether the DMP firmware is still resident in the MPU.
+ * The MPU keeps its memory banks across an ESP32 soft reset or light sleep as
+ * long as it stays powered. Compares the program start address in
+ * DMP_CFG_1/2 and the first MPU6050_DMP_SIGNATURE_SIZE bytes of every code
+ * bank, plus the end of the image, against dmpMemory; a handful of short reads
+ * instead of a full upload.
+ * @return true if the firmware image looks intact
+ */
+bool MPU6050::dmpFirmwarePresent()
+{
+    uint32_t errorsBefore = I2Cdev::errors;
+    if (getDMPConfig1() != (MPU6050_DMP_START_ADDRESS >> 8) || getDMPConfig2() != (MPU6050_DMP_START_ADDRESS & 0xFF))
+        return false;
+
+    uint8_t window[MPU6050_DMP_SIGNATURE_SIZE];
+    bool intact = true;
+    for (uint16_t offset = MPU6050_DMP_START_ADDRESS; intact && offset < MPU6050_DMP_CODE_SIZE; offset += MPU6050_DMP_MEMORY_BANK_SIZE)
+    {
+        uint16_t remaining = MPU6050_DMP_CODE_SIZE - offset;
+        uint16_t length = remaining < sizeof(window) ? remaining : sizeof(window);
+        readMemoryBlock(window, length, offset >> 8, offset & 0xFF);
+        intact = memcmp(window, dmpMemory + offset, length) == 0;
+    }
+    if (intact)
+    {
+        uint16_t tail = MPU6050_DMP_CODE_SIZE - sizeof(window);
+        readMemoryBlock(window, sizeof(window), tail >> 8, tail & 0xFF);
+        intact = memcmp(window, dmpMemory + tail, sizeof(window)) == 0;
+    }
+    setMemoryBank(0);
+    return intact && I2Cdev::errors == errorsBefore;
+}
+
+/** Bring the DMP up, reusing resident firmware when possible.
+ * If dmpFirmwarePresent() finds the image intact, only the registers
+ * dmpInitialize() configures around the firmware are restored and the FIFO
+ * and DMP are reset, which takes a few milliseconds; dmpUploadTime is then 0.
+ * Otherwise this is a full dmpInitialize(). Either way the DMP is left
+ * disabled with the FIFO enabled, as after dmpInitialize().
+ * @return 0 on success, dmpInitialize() error code otherwise
+ */
+uint8_t MPU6050::dmpResume()
+{
+    setSleepEnabled(false);
+    if (!dmpFirmwarePresent())
+    {
+        DEBUG_PRINTLN(F("No resident DMP firmware, initializing..."));
+        return dmpInitialize();
+    }
+
+    setClockSource(MPU6050_CLOCK_PLL_ZGYRO);
+    setIntEnabled(0x12);
+    setRate(4);
+    setExternalFrameSync(MPU6050_EXT_SYNC_TEMP_OUT_L);
+    setDLPFMode(MPU6050_DLPF_BW_42);
+    setFullScaleGyroRange(MPU6050_GYRO_FS_2000);
+    setDMPEnabled(false);
+    resetDMP();
+
+    if (!dmpSetFIFOLayout(dmpFIFOLayout) || dmpSetFIFORate(dmpFIFORate) != 0)
+        return 2;
+    dmpUploadTime = 0;
+    resetFIFO();
+    setFIFOEnabled(true);
+    getIntStatus();
+    return 0;
+}
+
+/** Choose what the DMP writes to the FIFO with each sample.
+ * The quaternion and footer are always sent; MPU6050_DMP_FIFO_GYRO and
+ * MPU6050_DMP_FIFO_ACCEL add the gyro and accel vectors: 18 bytes for the
+ * quaternion alone, 30 with one vector, 42 with both. The FIFO read time
+ * scales with it, but a caller that still needs the dropped data pays for
+ * reading it from the sensor registers instead. Takes effect on the resident firmware right away and is applied
+ * again by every dmpInitialize()/dmpResume(). Call it with the DMP disabled;
+ * the FIFO is reset, since it may hold packets of the old size.
+ * @param layout Combination of MPU6050_DMP_FIFO_GYRO and MPU6050_DMP_FIFO_ACCEL
+ * @return Status of operation (true = success)
+ */
+bool MPU6050::dmpSetFIFOLayout(uint8_t layout)
+{
+    const uint8_t send[4] = {0xF1, 0x28, 0x30, 0x38}; // 3 x 32-bit, as in the image
+    const uint8_t skip[4] = {MPU6050_DMP_CFG_DISABLED, MPU6050_DMP_CFG_DISABLED, MPU6050_DMP_CFG_DISABLED, MPU6050_DMP_CFG_DISABLED};
+
+    bool ok = writeMemoryBlock((layout & MPU6050_DMP_FIFO_GYRO) ? send : skip, 4,
+                               MPU6050_DMP_CFG_GYRO_ADDRESS >> 8, MPU6050_DMP_CFG_GYRO_ADDRESS & 0xFF);
+    ok = ok && writeMemoryBlock((layout & MPU6050_DMP_FIFO_ACCEL) ? send : skip, 4,
+                                MPU6050_DMP_CFG_ACCEL_ADDRESS >> 8, MPU6050_DMP_CFG_ACCEL_ADDRESS & 0xFF);
+    setMemoryBank(0);
+    if (!ok)
+        return false;
+
+    dmpFIFOLayout = layout;
+    dmpPacketSize = MPU6050_DMP_QUATERNION_SIZE + MPU6050_DMP_FOOTER_SIZE;
+    if (layout & MPU6050_DMP_FIFO_GYRO)
+        dmpPacketSize += MPU6050_DMP_VECTOR_SIZE;
+    if (layout & MPU6050_DMP_FIFO_ACCEL)
+        dmpPacketSize += MPU6050_DMP_VECTOR_SIZE;
+    resetFIFO();
+    return true;
+}
+
+uint8_t MPU6050::dmpGetFIFOLayout()
+{
+    return dmpFIFOLayout;
+}
+
+// Offset of a vector field in the current packet layout, -1 if it is not sent
+static int8_t dmpFieldOffset(uint8_t layout, uint8_t field)
+{
+    if (!(layout & field))
+        return -1;
+    int8_t offset = MPU6050_DMP_QUATERNION_SIZE;
+    if (field == MPU6050_DMP_FIFO_ACCEL && (layout & MPU6050_DMP_FIFO_GYRO))
+        offset += MPU6050_DMP_VECTOR_SIZE;
+    return offset;
+}
+
 bool MPU6050::dmpPacketAvailable()
 {
     return getFIFOCount() >= dmpGetFIFOPacketSize();
 }
 
-// uint8_t MPU6050::dmpSetFIFORate(uint8_t fifoRate);
-// uint8_t MPU6050::dmpGetFIFORate();
-// uint8_t MPU6050::dmpGetSampleStepSizeMS();
-// uint8_t MPU6050::dmpGetSampleFrequency();
+/** Set the DMP output rate divisor.
+ * The DMP sends a packet every (1 + fifoRate) samples of its 200 Hz loop
+ * (0 = 200 Hz, 1 = 100 Hz, 3 = 50 Hz). Safe to change while the DMP is
+ * running; applied again by every dmpInitialize()/dmpResume().
+ * @param fifoRate Rate divisor
+ * @return 0 on success, 1 on a bus or verification error
+ * @see MPU6050_DMP_FIFO_RATE_ADDRESS
+ */
+uint8_t MPU6050::dmpSetFIFORate(uint8_t fifoRate)
+{
+    uint8_t divisor[2] = {0x00, fifoRate};
+    bool ok = writeMemoryBlock(divisor, 2, MPU6050_DMP_FIFO_RATE_ADDRESS >> 8, MPU6050_DMP_FIFO_RATE_ADDRESS & 0xFF);
+    setMemoryBank(0);
+    if (!ok)
+        return 1;
+    dmpFIFORate = fifoRate;
+    return 0;
+}
+
+uint8_t MPU6050::dmpGetFIFORate()
+{
+    return dmpFIFORate;
+}
+
+/** Get the time between DMP packets at the current output rate.
+ * @return Packet period in milliseconds
+ */
+uint8_t MPU6050::dmpGetSampleStepSizeMS()
+{
+    return 1000 * (1 + dmpFIFORate) / MPU6050_DMP_SAMPLE_RATE;
+}
+
+/** Get the DMP output rate.
+ * @return Packets per second
+ */
+uint8_t MPU6050::dmpGetSampleFrequency()
+{
+    return MPU6050_DMP_SAMPLE_RATE / (1 + dmpFIFORate);
+}
 // int32_t MPU6050::dmpDecodeTemperature(int8_t tempReg);
 
 // uint8_t MPU6050::dmpRegisterFIFORateProcess(inv_obj_func func, int16_t priority);
@@ -2402,32 +2564,41 @@ bool MPU6050::dmpPacketAvailable()
 
 uint8_t MPU6050::dmpGetAccel(int32_t *data, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_ACCEL);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    data[0] = (((uint32_t)packet[28] << 24) | ((uint32_t)packet[29] << 16) | ((uint32_t)packet[30] << 8) | packet[31]);
-    data[1] = (((uint32_t)packet[32] << 24) | ((uint32_t)packet[33] << 16) | ((uint32_t)packet[34] << 8) | packet[35]);
-    data[2] = (((uint32_t)packet[36] << 24) | ((uint32_t)packet[37] << 16) | ((uint32_t)packet[38] << 8) | packet[39]);
+    const uint8_t *p = packet + offset;
+    data[0] = (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]);
+    data[1] = (((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7]);
+    data[2] = (((uint32_t)p[8] << 24) | ((uint32_t)p[9] << 16) | ((uint32_t)p[10] << 8) | p[11]);
     return 0;
 }
 uint8_t MPU6050::dmpGetAccel(int16_t *data, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_ACCEL);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    data[0] = (packet[28] << 8) | packet[29];
-    data[1] = (packet[32] << 8) | packet[33];
-    data[2] = (packet[36] << 8) | packet[37];
+    const uint8_t *p = packet + offset;
+    data[0] = (p[0] << 8) | p[1];
+    data[1] = (p[4] << 8) | p[5];
+    data[2] = (p[8] << 8) | p[9];
     return 0;
 }
 uint8_t MPU6050::dmpGetAccel(VectorInt16 *v, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_ACCEL);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    v->x = (packet[28] << 8) | packet[29];
-    v->y = (packet[32] << 8) | packet[33];
-    v->z = (packet[36] << 8) | packet[37];
+    const uint8_t *p = packet + offset;
+    v->x = (p[0] << 8) | p[1];
+    v->y = (p[4] << 8) | p[5];
+    v->z = (p[8] << 8) | p[9];
     return 0;
 }
 uint8_t MPU6050::dmpGetQuaternion(int32_t *data, const uint8_t *packet)
@@ -2471,32 +2642,41 @@ uint8_t MPU6050::dmpGetQuaternion(Quaternion *q, const uint8_t *packet)
 // uint8_t MPU6050::dmpGetRelativeQuaternion(long *data, const uint8_t* packet);
 uint8_t MPU6050::dmpGetGyro(int32_t *data, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_GYRO);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    data[0] = (((uint32_t)packet[16] << 24) | ((uint32_t)packet[17] << 16) | ((uint32_t)packet[18] << 8) | packet[19]);
-    data[1] = (((uint32_t)packet[20] << 24) | ((uint32_t)packet[21] << 16) | ((uint32_t)packet[22] << 8) | packet[23]);
-    data[2] = (((uint32_t)packet[24] << 24) | ((uint32_t)packet[25] << 16) | ((uint32_t)packet[26] << 8) | packet[27]);
+    const uint8_t *p = packet + offset;
+    data[0] = (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]);
+    data[1] = (((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7]);
+    data[2] = (((uint32_t)p[8] << 24) | ((uint32_t)p[9] << 16) | ((uint32_t)p[10] << 8) | p[11]);
     return 0;
 }
 uint8_t MPU6050::dmpGetGyro(int16_t *data, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_GYRO);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    data[0] = (packet[16] << 8) | packet[17];
-    data[1] = (packet[20] << 8) | packet[21];
-    data[2] = (packet[24] << 8) | packet[25];
+    const uint8_t *p = packet + offset;
+    data[0] = (p[0] << 8) | p[1];
+    data[1] = (p[4] << 8) | p[5];
+    data[2] = (p[8] << 8) | p[9];
     return 0;
 }
 uint8_t MPU6050::dmpGetGyro(VectorInt16 *v, const uint8_t *packet)
 {
-    // TODO: accommodate different arrangements of sent data (ONLY default supported now)
+    int8_t offset = dmpFieldOffset(dmpFIFOLayout, MPU6050_DMP_FIFO_GYRO);
+    if (offset < 0)
+        return 1; // not in the packet layout
     if (packet == 0)
         packet = dmpPacketBuffer;
-    v->x = (packet[16] << 8) | packet[17];
-    v->y = (packet[20] << 8) | packet[21];
-    v->z = (packet[24] << 8) | packet[25];
+    const uint8_t *p = packet + offset;
+    v->x = (p[0] << 8) | p[1];
+    v->y = (p[4] << 8) | p[5];
+    v->z = (p[8] << 8) | p[9];
     return 0;
 }
 // uint8_t MPU6050::dmpSetLinearAccelFilterCoefficient(float coef);
@@ -2564,6 +2744,64 @@ uint8_t MPU6050::dmpGetYawPitchRoll(float *data, Quaternion *q, VectorFloat *gra
     return 0;
 }
 
+// atan(z) for |z| <= 1 as an odd polynomial, max error about 1e-5 rad
+static inline float dmpAtanUnit(float z)
+{
+    float z2 = z * z;
+    return z * (0.99997726f + z2 * (-0.33262347f + z2 * (0.19354346f + z2 * (-0.11643287f + z2 * (0.05265332f + z2 * -0.01172120f)))));
+}
+
+/** Get pitch in degrees straight from the FIFO quaternion.
+ * Same angle as dmpGetYawPitchRoll() data[1], without yaw and roll: the two
+ * gravity terms pitch needs are formed in integer from the Q14 quaternion,
+ * then one sqrt, one division and a polynomial atan replace the float
+ * quaternion, gravity vector and libm atan/sqrt calls.
+ * @param pitch Pitch in degrees (nose up/down, about Y)
+ * @param packet FIFO packet, or 0 for the last one processed
+ * @return 0 on success
+ */
+uint8_t MPU6050::dmpGetPitch(float *pitch, const uint8_t *packet)
+{
+    int16_t qI[4];
+    uint8_t status = dmpGetQuaternion(qI, packet);
+    if (status != 0)
+        return status;
+
+    // gravity x, y, z in Q28 (see dmpGetGravity())
+    int32_t gx = 2 * ((int32_t)qI[1] * qI[3] - (int32_t)qI[0] * qI[2]);
+    int32_t gy = 2 * ((int32_t)qI[0] * qI[1] + (int32_t)qI[2] * qI[3]);
+    int32_t gz = (int32_t)qI[0] * qI[0] - (int32_t)qI[1] * qI[1] - (int32_t)qI[2] * qI[2] + (int32_t)qI[3] * qI[3];
+
+    // atan2(gx, sqrt(gy^2 + gz^2)); the scale cancels, so no conversion to g
+    float y = (float)gx;
+    float x = sqrtf((float)gy * gy + (float)gz * gz);
+    float angle;
+    if (fabsf(y) <= x)
+        angle = dmpAtanUnit(y / x);
+    else
+        angle = (y > 0 ? (float)M_PI_2 : -(float)M_PI_2) - dmpAtanUnit(x / y);
+    *pitch = angle * (float)(180.0 / M_PI);
+    return 0;
+}
+
+/** Get the pitch rate in degrees per second from the FIFO gyro vector.
+ * The negated Y rate, which is the derivative of dmpGetPitch() while roll
+ * stays small (a balancing robot).
+ * @param rate Pitch rate in degrees per second
+ * @param packet FIFO packet, or 0 for the last one processed
+ * @return 0 on success, 1 if the gyro is not in the packet layout
+ * @see dmpSetFIFOLayout()
+ */
+uint8_t MPU6050::dmpGetPitchRate(float *rate, const uint8_t *packet)
+{
+    int16_t gyro[3];
+    uint8_t status = dmpGetGyro(gyro, packet);
+    if (status != 0)
+        return status;
+    *rate = -gyro[1] / MPU6050_DMP_GYRO_LSB_PER_DPS;
+    return 0;
+}
+
 // uint8_t MPU6050::dmpGetAccelFloat(float *data, const uint8_t* packet);
 // uint8_t MPU6050::dmpGetQuaternionFloat(float *data, const uint8_t* packet);
 
@@ -2598,6 +2836,70 @@ uint8_t MPU6050::dmpReadAndProcessFIFOPacket(uint8_t numPackets, uint8_t *proces
     return 0;
 }
 
+/** Drain the FIFO and keep only the newest DMP packet.
+ * Every whole packet in the FIFO is read in MPU6050_FIFO_BURST_SIZE bursts,
+ * so a loop that fell behind catches up in one call and acts on the latest
+ * attitude. Bytes past the last whole packet belong to one the DMP is still
+ * writing; they stay in the FIFO for the next read. This relies on the FIFO
+ * starting on a packet boundary, which only an overflow breaks: check
+ * FIFO_OFLOW in INT_STATUS and reset the FIFO on it before calling. If the
+ * kept packet still does not hold a unit quaternion the FIFO was out of step
+ * and is reset.
+ * @param packet Buffer for the newest packet (dmpGetFIFOPacketSize() bytes)
+ * @param skipped Number of older packets discarded, if supplied
+ * @param fifoCount FIFO count if the caller just read it (0 = read it here)
+ * @return 0 = packet read, 1 = no whole packet in the FIFO, 2 = bus error, 3 = out of step (FIFO reset)
+ */
+uint8_t MPU6050::dmpGetLatestFIFOPacket(uint8_t *packet, uint16_t *skipped, uint16_t fifoCount)
+{
+    if (skipped != NULL)
+        *skipped = 0;
+
+    uint32_t errorsBefore = I2Cdev::errors;
+    if (fifoCount == 0)
+        fifoCount = getFIFOCount();
+    if (I2Cdev::errors != errorsBefore)
+        return 2;
+    if (fifoCount < dmpPacketSize || fifoCount > MPU6050_FIFO_SIZE)
+        return 1;
+
+    // whole packets only; size the first burst so the last one holds the
+    // whole newest packet
+    uint16_t packets = fifoCount / dmpPacketSize;
+    uint16_t total = packets * dmpPacketSize;
+    uint8_t buf[MPU6050_FIFO_BURST_SIZE];
+    uint16_t bursts = (total + MPU6050_FIFO_BURST_SIZE - 1) / MPU6050_FIFO_BURST_SIZE;
+    uint8_t length = total - (bursts - 1) * MPU6050_FIFO_BURST_SIZE;
+    for (uint16_t i = 0; i < bursts; i++)
+    {
+        if (i > 0)
+            length = MPU6050_FIFO_BURST_SIZE;
+        // readBytes() returns its length as int8_t, which is negative for a
+        // full burst: go by the bus error count instead
+        I2Cdev::readBytes(devAddr, MPU6050_RA_FIFO_R_W, length, buf);
+        if (I2Cdev::errors != errorsBefore)
+            return 2;
+    }
+    memcpy(packet, buf + length - dmpPacketSize, dmpPacketSize);
+
+    if (skipped != NULL)
+        *skipped = packets - 1;
+
+    float norm = 0;
+    for (uint8_t i = 0; i < 16; i += 4)
+    {
+        int32_t v = ((uint32_t)packet[i] << 24) | ((uint32_t)packet[i + 1] << 16) | ((uint32_t)packet[i + 2] << 8) | packet[i + 3];
+        float f = v / 1073741824.0f;
+        norm += f * f;
+    }
+    if (norm < 0.81f || norm > 1.21f)
+    {
+        resetFIFO();
+        return 3;
+    }
+    return 0;
+}
+
 // uint8_t MPU6050::dmpSetFIFOProcessedCallback(void (*func) (void));
 
 // uint8_t MPU6050::dmpInitFIFOParam();
@@ -0,0 +1,485 @@
+// I2Cdev library collection - MPU6050 register-file emulator
+// See MPU6050_Emulator.h for what is and is not modelled.
+
+/* ============================================
+I2Cdev device library code is placed under the MIT license
+Copyright (c) 2012 Jeff Rowberg
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+// Host builds only; an Arduino build compiles every file in the library
+#if !defined(ESP_PLATFORM) && !defined(ARDUINO)
+
+#include <string.h>
+#include "MPU6050_Emulator.h"
+
+// Silicon revision byte read back by dmpInitialize()
+#define EMU_HW_REVISION_BANK   16
+#define EMU_HW_REVISION_OFFSET 6
+
+static void putInt16(uint8_t *p, int32_t value) {
+    if (value > 32767) value = 32767;
+    if (value < -32768) value = -32768;
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static void putInt32(uint8_t *p, int32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static int16_t getInt16(const uint8_t *p) {
+    return (int16_t)((p[0] << 8) | p[1]);
+}
+
+MPU6050Emulator::MPU6050Emulator(uint8_t address) {
+    this->address = address;
+    clockHz = 400000;
+    overheadUs = 0;
+    splitReads = false;
+    faultCount = 0;
+    faultStatus = I2CDEV_OK;
+    interruptCallback = NULL;
+    interruptArg = NULL;
+    setAttitude(1, 0, 0, 0);
+    setRotationRate(0, 0, 0);
+    setGyroBias(0, 0, 0);
+    setAccelBias(0, 0, 0);
+    setTemperature(25);
+    nowNs = 0;
+    resetCounters();
+    powerOn();
+}
+
+/** Power-on reset: register file, DMP memory and FIFO to their reset state.
+ * Simulated time and the transaction counters are left running.
+ */
+void MPU6050Emulator::powerOn() {
+    memset(regs, 0, sizeof(regs));
+    memset(memory, 0, sizeof(memory));
+    regs[MPU6050_RA_PWR_MGMT_1] = 1 << MPU6050_PWR1_SLEEP_BIT;
+    regs[MPU6050_RA_WHO_AM_I] = MPU6050_DEFAULT_ADDRESS;
+    memory[EMU_HW_REVISION_BANK][EMU_HW_REVISION_OFFSET] = 0x01;
+    fifoHead = 0;
+    fifoCount = 0;
+    fifoLast = 0;
+    nextSampleNs = nowNs + samplePeriodNs();
+}
+
+int8_t MPU6050Emulator::read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout) {
+    if (faultCount > 0) return fault(timeout);
+    if (devAddr != address) {
+        account(1 + 9 + 1, 1, 0);
+        return I2CDEV_ERR_NACK;
+    }
+    updateSensorRegisters();
+    uint8_t reg = regAddr & 0x7F;
+    for (uint8_t i = 0; i < length; i++) {
+        data[i] = readRegister(reg);
+        // FIFO and DMP memory ports do not advance the register pointer
+        if (reg != MPU6050_RA_FIFO_R_W && reg != MPU6050_RA_MEM_R_W) reg = (reg + 1) & 0x7F;
+    }
+    if (splitReads) {
+        // pointer write + STOP, then a separate addressed read
+        account((1 + 9 + 9 + 1) + (1 + 9 + 9 * length + 1), 2, 2 + length);
+    } else {
+        // START, addr+W, reg, repeated START, addr+R, data, STOP
+        account(9 * (3 + length) + 3, 1, 3 + length);
+    }
+    return I2CDEV_OK;
+}
+
+int8_t MPU6050Emulator::write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout) {
+    if (faultCount > 0) return fault(timeout);
+    if (devAddr != address) {
+        account(1 + 9 + 1, 1, 0);
+        return I2CDEV_ERR_NACK;
+    }
+    uint8_t reg = regAddr & 0x7F;
+    for (uint8_t i = 0; i < length; i++) {
+        writeRegister(reg, data[i]);
+        if (reg != MPU6050_RA_FIFO_R_W && reg != MPU6050_RA_MEM_R_W) reg = (reg + 1) & 0x7F;
+    }
+    account(9 * (2 + length) + 2, 1, 2 + length);
+    return I2CDEV_OK;
+}
+
+void MPU6050Emulator::delay(uint32_t ms) {
+    advance(ms * 1000);
+}
+
+uint32_t MPU6050Emulator::micros() {
+    return (uint32_t)(nowNs / 1000);
+}
+
+/** Advance simulated time, producing any samples that fall due.
+ * @param us Microseconds to advance
+ */
+void MPU6050Emulator::advance(uint32_t us) {
+    nowNs += (uint64_t)us * 1000;
+    while (nextSampleNs <= nowNs) {
+        sample();
+        nextSampleNs += samplePeriodNs();
+    }
+}
+
+/** Set the bus clock the transaction timing is computed at.
+ * @see I2CdevBus::setClock()
+ */
+bool MPU6050Emulator::setClock(uint32_t clockHz) {
+    if (clockHz == 0 || clockHz > I2CDEV_MAX_CLOCK) return false;
+    this->clockHz = clockHz;
+    return true;
+}
+
+uint32_t MPU6050Emulator::getClock() {
+    return clockHz;
+}
+
+/** Set a fixed per-transaction cost on top of the bits on the wire.
+ * Models driver setup and interrupt latency of the host I2C stack.
+ * @param us Microseconds added to every transaction
+ */
+void MPU6050Emulator::setTransactionOverhead(uint32_t us) {
+    overheadUs = us;
+}
+
+/** Account register reads as a pointer write followed by a separate read.
+ * This is how I2Cdev issued reads before the single repeated-start
+ * transaction, and is kept to compare the two.
+ * @param split True to account reads as two transactions
+ */
+void MPU6050Emulator::setSplitReads(bool split) {
+    splitReads = split;
+}
+
+/** Set the simulated attitude as a unit quaternion (w, x, y, z).
+ * Drives both the DMP quaternion and the gravity vector in the accelerometer.
+ */
+void MPU6050Emulator::setAttitude(float w, float x, float y, float z) {
+    attitude[0] = w;
+    attitude[1] = x;
+    attitude[2] = y;
+    attitude[3] = z;
+}
+
+/** Set the simulated angular rate in degrees per second.
+ */
+void MPU6050Emulator::setRotationRate(float x, float y, float z) {
+    rate[0] = x;
+    rate[1] = y;
+    rate[2] = z;
+}
+
+/** Set the uncalibrated gyro bias in +-250 deg/s LSBs.
+ * The offset registers (XG_OFFS_USR etc.) cancel it as on the real part.
+ */
+void MPU6050Emulator::setGyroBias(int16_t x, int16_t y, int16_t z) {
+    gyroBias[0] = x;
+    gyroBias[1] = y;
+    gyroBias[2] = z;
+}
+
+/** Set the uncalibrated accelerometer bias in +-2g LSBs.
+ * The offset registers (XA_OFFS etc.) cancel it as on the real part.
+ */
+void MPU6050Emulator::setAccelBias(int16_t x, int16_t y, int16_t z) {
+    accelBias[0] = x;
+    accelBias[1] = y;
+    accelBias[2] = z;
+}
+
+void MPU6050Emulator::setTemperature(float celsius) {
+    temperature = celsius;
+}
+
+/** Make the next transactions fail without touching the device.
+ * A timeout charges the full transaction timeout to the simulated clock, the
+ * way a stuck bus holds up the caller; other failures cost an address byte.
+ * @param count Number of transactions to fail
+ * @param status I2CDEV_ERR_* code to fail them with
+ */
+void MPU6050Emulator::failNext(uint32_t count, int8_t status) {
+    faultCount = count;
+    faultStatus = status;
+}
+
+/** Set a callback standing in for the INT pin.
+ * Called from inside a bus transaction or delay() whenever a source enabled
+ * in INT_ENABLE is raised.
+ */
+void MPU6050Emulator::setInterruptCallback(void (*callback)(void *arg), void *arg) {
+    interruptCallback = callback;
+    interruptArg = arg;
+}
+
+uint8_t MPU6050Emulator::getRegister(uint8_t regAddr) {
+    return regs[regAddr & 0x7F];
+}
+
+uint8_t MPU6050Emulator::getMemory(uint8_t bank, uint8_t address) {
+    return memory[bank % MPU6050_EMU_MEMORY_BANKS][address];
+}
+
+uint16_t MPU6050Emulator::getFIFOCount() {
+    return fifoCount;
+}
+
+uint64_t MPU6050Emulator::getTimeUs() {
+    return nowNs / 1000;
+}
+
+/** Get time spent on the bus (wire time plus per-transaction overhead).
+ * @return Microseconds since the last resetCounters()
+ */
+uint64_t MPU6050Emulator::getBusTimeUs() {
+    return busTimeNs / 1000;
+}
+
+uint32_t MPU6050Emulator::getTransactionCount() {
+    return transactions;
+}
+
+/** Get bytes clocked on the bus, address and register pointer bytes included.
+ */
+uint32_t MPU6050Emulator::getByteCount() {
+    return bytes;
+}
+
+/** Get the number of DMP packets lost to FIFO overflow.
+ */
+uint32_t MPU6050Emulator::getDroppedPackets() {
+    return droppedPackets;
+}
+
+void MPU6050Emulator::resetCounters() {
+    busTimeNs = 0;
+    transactions = 0;
+    bytes = 0;
+    droppedPackets = 0;
+}
+
+uint8_t MPU6050Emulator::readRegister(uint8_t regAddr) {
+    uint8_t value;
+    switch (regAddr) {
+        case MPU6050_RA_INT_STATUS:
+            value = regs[regAddr];
+            regs[regAddr] = 0;
+            return value;
+        case MPU6050_RA_FIFO_COUNTH:
+            return fifoCount >> 8;
+        case MPU6050_RA_FIFO_COUNTL:
+            return fifoCount & 0xFF;
+        case MPU6050_RA_FIFO_R_W:
+            // reading an empty FIFO repeats the last byte
+            if (fifoCount > 0) {
+                fifoLast = fifo[fifoHead];
+                fifoHead = (fifoHead + 1) % MPU6050_EMU_FIFO_SIZE;
+                fifoCount--;
+            }
+            return fifoLast;
+        case MPU6050_RA_MEM_R_W:
+            value = memory[regs[MPU6050_RA_BANK_SEL] % MPU6050_EMU_MEMORY_BANKS][regs[MPU6050_RA_MEM_START_ADDR]];
+            regs[MPU6050_RA_MEM_START_ADDR]++;
+            return value;
+        default:
+            return regs[regAddr];
+    }
+}
+
+void MPU6050Emulator::writeRegister(uint8_t regAddr, uint8_t value) {
+    switch (regAddr) {
+        case MPU6050_RA_INT_STATUS:
+        case MPU6050_RA_WHO_AM_I:
+        case MPU6050_RA_FIFO_COUNTH:
+        case MPU6050_RA_FIFO_COUNTL:
+            return;
+        case MPU6050_RA_FIFO_R_W:
+            pushFIFO(&value, 1);
+            return;
+        case MPU6050_RA_MEM_R_W:
+            memory[regs[MPU6050_RA_BANK_SEL] % MPU6050_EMU_MEMORY_BANKS][regs[MPU6050_RA_MEM_START_ADDR]] = value;
+            regs[MPU6050_RA_MEM_START_ADDR]++;
+            return;
+        case MPU6050_RA_USER_CTRL:
+            if (value & (1 << MPU6050_USERCTRL_FIFO_RESET_BIT)) {
+                fifoHead = 0;
+                fifoCount = 0;
+            }
+            // reset strobes self-clear
+            regs[regAddr] = value & 0xF0;
+            return;
+        case MPU6050_RA_SIGNAL_PATH_RESET:
+            return;
+        case MPU6050_RA_PWR_MGMT_1:
+            if (value & (1 << MPU6050_PWR1_DEVICE_RESET_BIT)) {
+                powerOn();
+                return;
+            }
+            regs[regAddr] = value;
+            return;
+        case MPU6050_RA_SMPLRT_DIV:
+        case MPU6050_RA_CONFIG:
+            regs[regAddr] = value;
+            nextSampleNs = nowNs + samplePeriodNs();
+            return;
+        default:
+            regs[regAddr] = value;
+            return;
+    }
+}
+
+int8_t MPU6050Emulator::fault(uint16_t timeout) {
+    faultCount--;
+    if (faultStatus == I2CDEV_ERR_TIMEOUT) {
+        transactions++;
+        busTimeNs += (uint64_t)timeout * 1000000;
+        advance((uint32_t)timeout * 1000);
+    } else {
+        account(1 + 9 + 1, 1, 0);
+    }
+    return faultStatus;
+}
+
+/** Account one bus operation and advance simulated time by its duration.
+ * @param bits Clock periods on the wire (START/STOP counted as one each)
+ * @param count Number of separate transactions it took
+ * @param payload Bytes clocked, address bytes included
+ */
+void MPU6050Emulator::account(uint32_t bits, uint32_t count, uint32_t payload) {
+    uint64_t ns = (uint64_t)bits * 1000000000ULL / clockHz + (uint64_t)count * overheadUs * 1000;
+    busTimeNs += ns;
+    transactions += count;
+    bytes += payload;
+    nowNs += ns;
+    while (nextSampleNs <= nowNs) {
+        sample();
+        nextSampleNs += samplePeriodNs();
+    }
+}
+
+/** Sensor sample period: gyro output rate / (1 + SMPLRT_DIV), further
+ * divided by the DMP FIFO rate divisor while the DMP is running.
+ */
+uint64_t MPU6050Emulator::samplePeriodNs() {
+    uint8_t dlpf = regs[MPU6050_RA_CONFIG] & 0x07;
+    uint64_t period = (dlpf == 0 || dlpf == 7) ? 125000 : 1000000;
+    period *= 1 + regs[MPU6050_RA_SMPLRT_DIV];
+    if (regs[MPU6050_RA_USER_CTRL] & (1 << MPU6050_USERCTRL_DMP_EN_BIT)) {
+        const uint8_t *div = &memory[MPU6050_DMP_FIFO_RATE_ADDRESS >> 8][MPU6050_DMP_FIFO_RATE_ADDRESS & 0xFF];
+        period *= 1 + ((div[0] << 8) | div[1]);
+    }
+    return period;
+}
+
+void MPU6050Emulator::sample() {
+    if (regs[MPU6050_RA_PWR_MGMT_1] & (1 << MPU6050_PWR1_SLEEP_BIT)) return;
+    uint8_t userCtrl = regs[MPU6050_RA_USER_CTRL];
+    uint8_t status = 1 << MPU6050_INTERRUPT_DATA_RDY_BIT;
+
+    if ((userCtrl & (1 << MPU6050_USERCTRL_DMP_EN_BIT)) && (userCtrl & (1 << MPU6050_USERCTRL_FIFO_EN_BIT))) {
+        // MotionApps 2.0 packet: quaternion (q30), gyro and accel (<< 16) unless
+        // switched off in the firmware (see MPU6050::dmpSetFIFOLayout()), footer
+        uint8_t packet[MPU6050_EMU_DMP_PACKET_SIZE];
+        uint8_t length = 0;
+        memset(packet, 0, sizeof(packet));
+        for (uint8_t i = 0; i < 4; i++) {
+            putInt32(packet + 4 * i, (int32_t)(attitude[i] * 1073741824.0f));
+        }
+        length += MPU6050_DMP_QUATERNION_SIZE;
+        if (getMemory(MPU6050_DMP_CFG_GYRO_ADDRESS >> 8, MPU6050_DMP_CFG_GYRO_ADDRESS & 0xFF) != MPU6050_DMP_CFG_DISABLED) {
+            for (uint8_t i = 0; i < 3; i++) {
+                // DMP reports gyro at +-2000 deg/s and accel at 8192 LSB/g
+                putInt32(packet + length + 4 * i, (int32_t)(rate[i] * 16.4f) << 16);
+            }
+            length += MPU6050_DMP_VECTOR_SIZE;
+        }
+        if (getMemory(MPU6050_DMP_CFG_ACCEL_ADDRESS >> 8, MPU6050_DMP_CFG_ACCEL_ADDRESS & 0xFF) != MPU6050_DMP_CFG_DISABLED) {
+            const float *q = attitude;
+            float g[3] = {
+                2 * (q[1] * q[3] - q[0] * q[2]),
+                2 * (q[0] * q[1] + q[2] * q[3]),
+                q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]
+            };
+            for (uint8_t i = 0; i < 3; i++) {
+                putInt32(packet + length + 4 * i, (int32_t)(g[i] * 8192.0f) << 16);
+            }
+            length += MPU6050_DMP_VECTOR_SIZE;
+        }
+        length += MPU6050_DMP_FOOTER_SIZE;
+        pushFIFO(packet, length);
+        status |= 1 << MPU6050_INTERRUPT_DMP_INT_BIT;
+    }
+    raiseInterrupt(status);
+}
+
+/** Refresh ACCEL/TEMP/GYRO output registers from the simulated motion,
+ * with bias, offset registers and full-scale range applied.
+ */
+void MPU6050Emulator::updateSensorRegisters() {
+    const float *q = attitude;
+    float g[3] = {
+        2 * (q[1] * q[3] - q[0] * q[2]),
+        2 * (q[0] * q[1] + q[2] * q[3]),
+        q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]
+    };
+    uint8_t afs = (regs[MPU6050_RA_ACCEL_CONFIG] >> 3) & 0x03;
+    uint8_t gfs = (regs[MPU6050_RA_GYRO_CONFIG] >> 3) & 0x03;
+    for (uint8_t i = 0; i < 3; i++) {
+        // accel offset: bits [15:1] in 0.98 mg steps (8 LSB at +-2g per count)
+        int32_t offset = (int16_t)(getInt16(&regs[MPU6050_RA_XA_OFFS_H + 2 * i]) & 0xFFFE);
+        int32_t accel = (int32_t)(g[i] * 16384.0f) + accelBias[i] + offset * 8;
+        putInt16(&regs[MPU6050_RA_ACCEL_XOUT_H + 2 * i], accel >> afs);
+
+        // gyro offset: +-1000 deg/s LSBs (4 LSB at +-250 deg/s per count)
+        offset = getInt16(&regs[MPU6050_RA_XG_OFFS_USRH + 2 * i]);
+        int32_t gyro = (int32_t)(rate[i] * 131.0f) + gyroBias[i] + offset * 4;
+        putInt16(&regs[MPU6050_RA_GYRO_XOUT_H + 2 * i], gyro >> gfs);
+    }
+    putInt16(&regs[MPU6050_RA_TEMP_OUT_H], (int32_t)((temperature - 36.53f) * 340.0f));
+}
+
+void MPU6050Emulator::pushFIFO(const uint8_t *data, uint16_t length) {
+    if (fifoCount + length > MPU6050_EMU_FIFO_SIZE) {
+        // the real FIFO overwrites its oldest data
+        uint16_t drop = fifoCount + length - MPU6050_EMU_FIFO_SIZE;
+        fifoHead = (fifoHead + drop) % MPU6050_EMU_FIFO_SIZE;
+        fifoCount -= drop;
+        droppedPackets++;
+        raiseInterrupt(1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT);
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        fifo[(fifoHead + fifoCount) % MPU6050_EMU_FIFO_SIZE] = data[i];
+        fifoCount++;
+    }
+}
+
+void MPU6050Emulator::raiseInterrupt(uint8_t bits) {
+    regs[MPU6050_RA_INT_STATUS] |= bits;
+    if ((bits & regs[MPU6050_RA_INT_ENABLE]) && interruptCallback) {
+        interruptCallback(interruptArg);
+    }
+}
+
+#endif /* !ESP_PLATFORM && !ARDUINO */
@@ -0,0 +1,130 @@
+// I2Cdev library collection - MPU6050 register-file emulator
+// An I2CdevBus backend that behaves like an MPU6050 on the bus: register file
+// with reset values, WHO_AM_I, self-clearing strobes, clear-on-read
+// INT_STATUS, DMP memory banks behind BANK_SEL/MEM_START_ADDR/MEM_R_W, and a
+// 1024-byte FIFO fed with DMP packets at the configured output rate.
+//
+// Time is simulated. Every transaction advances the clock by its length on
+// the wire at the configured bus speed, and I2CdevBus::delay() advances it
+// without sleeping, so dmpInitialize() and FIFO polling loops run on a host
+// at full speed and bus occupancy can be measured exactly.
+
+/* ============================================
+I2Cdev device library code is placed under the MIT license
+Copyright (c) 2012 Jeff Rowberg
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+===============================================
+*/
+
+#ifndef _MPU6050_EMULATOR_H_
+#define _MPU6050_EMULATOR_H_
+
+#include "I2CdevBus.h"
+#include "MPU6050.h"
+
+#define MPU6050_EMU_FIFO_SIZE       1024
+#define MPU6050_EMU_MEMORY_BANKS    32
+#define MPU6050_EMU_DMP_PACKET_SIZE 42
+
+class MPU6050Emulator : public I2CdevBus {
+    public:
+        MPU6050Emulator(uint8_t address=MPU6050_DEFAULT_ADDRESS);
+
+        int8_t read(uint8_t devAddr, uint8_t regAddr, uint8_t length, uint8_t *data, uint16_t timeout);
+        int8_t write(uint8_t devAddr, uint8_t regAddr, uint8_t length, const uint8_t *data, uint16_t timeout);
+        void delay(uint32_t ms);
+        uint32_t micros();
+
+        void powerOn();
+        void advance(uint32_t us);
+
+        // bus timing model
+        bool setClock(uint32_t clockHz);
+        uint32_t getClock();
+        void setTransactionOverhead(uint32_t us);
+        void setSplitReads(bool split);
+
+        // simulated motion
+        void setAttitude(float w, float x, float y, float z);
+        void setRotationRate(float x, float y, float z);
+        void setGyroBias(int16_t x, int16_t y, int16_t z);
+        void setAccelBias(int16_t x, int16_t y, int16_t z);
+        void setTemperature(float celsius);
+
+        // fault injection
+        void failNext(uint32_t count, int8_t status);
+
+        // interrupt line, called whenever an enabled interrupt is raised
+        void setInterruptCallback(void (*callback)(void *arg), void *arg);
+
+        // inspection
+        uint8_t getRegister(uint8_t regAddr);
+        uint8_t getMemory(uint8_t bank, uint8_t address);
+        uint16_t getFIFOCount();
+        uint64_t getTimeUs();
+        uint64_t getBusTimeUs();
+        uint32_t getTransactionCount();
+        uint32_t getByteCount();
+        uint32_t getDroppedPackets();
+        void resetCounters();
+
+    private:
+        uint8_t address;
+        uint8_t regs[128];
+        uint8_t memory[MPU6050_EMU_MEMORY_BANKS][MPU6050_DMP_MEMORY_BANK_SIZE];
+        uint8_t fifo[MPU6050_EMU_FIFO_SIZE];
+        uint16_t fifoHead;
+        uint16_t fifoCount;
+        uint8_t fifoLast;
+
+        uint64_t nowNs;
+        uint64_t nextSampleNs;
+        uint64_t busTimeNs;
+        uint32_t transactions;
+        uint32_t bytes;
+        uint32_t droppedPackets;
+
+        uint32_t clockHz;
+        uint32_t overheadUs;
+        bool splitReads;
+        uint32_t faultCount;
+        int8_t faultStatus;
+
+        float attitude[4];
+        float rate[3];
+        int16_t gyroBias[3];
+        int16_t accelBias[3];
+        float temperature;
+
+        void (*interruptCallback)(void *arg);
+        void *interruptArg;
+
+        uint8_t readRegister(uint8_t regAddr);
+        void writeRegister(uint8_t regAddr, uint8_t value);
+        int8_t fault(uint16_t timeout);
+        void account(uint32_t bits, uint32_t count, uint32_t payload);
+        uint64_t samplePeriodNs();
+        void sample();
+        void updateSensorRegisters();
+        void pushFIFO(const uint8_t *data, uint16_t length);
+        void raiseInterrupt(uint8_t bits);
+};
+
+#endif /* _MPU6050_EMULATOR_H_ */
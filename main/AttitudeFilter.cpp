@@ -0,0 +1,93 @@
+#include "AttitudeFilter.h"
+#include <math.h>
+
+// Kalman noise settings (per second): pitch process noise, gyro bias drift, accel pitch noise
+static const float KALMAN_Q_ANGLE = 0.001f;
+static const float KALMAN_Q_BIAS = 0.003f;
+static const float KALMAN_R_MEASURE = 0.03f;
+
+static const float RAD_TO_DEGREES = 57.2957795f;
+
+AttitudeFilter::AttitudeFilter(AttitudeFilterType type)
+    : type(type), started(false), pitch(0), rate(0), timeConstant(0.5f), bias(0)
+{
+    reset(0);
+    started = false;
+}
+
+void AttitudeFilter::setType(AttitudeFilterType newType)
+{
+    type = newType;
+    started = false;
+}
+
+void AttitudeFilter::setTimeConstant(float seconds)
+{
+    timeConstant = seconds;
+}
+
+void AttitudeFilter::reset(float newPitch)
+{
+    pitch = newPitch;
+    rate = 0;
+    bias = 0;
+    p[0][0] = 0;
+    p[0][1] = 0;
+    p[1][0] = 0;
+    p[1][1] = 0;
+    started = true;
+}
+
+float AttitudeFilter::update(float accelPitch, float gyroRate, float dt)
+{
+    // Start from the accel angle instead of converging from 0
+    if (!started)
+    {
+        reset(accelPitch);
+        rate = gyroRate;
+        return pitch;
+    }
+
+    if (type == FILTER_COMPLEMENTARY)
+    {
+        float alpha = timeConstant / (timeConstant + dt);
+        rate = gyroRate;
+        pitch = alpha * (pitch + gyroRate * dt) + (1 - alpha) * accelPitch;
+        return pitch;
+    }
+
+    // Predict with the bias-corrected gyro
+    rate = gyroRate - bias;
+    pitch += rate * dt;
+    p[0][0] += dt * (dt * p[1][1] - p[0][1] - p[1][0] + KALMAN_Q_ANGLE);
+    p[0][1] -= dt * p[1][1];
+    p[1][0] -= dt * p[1][1];
+    p[1][1] += KALMAN_Q_BIAS * dt;
+
+    // Correct with the accel angle
+    float s = p[0][0] + KALMAN_R_MEASURE;
+    float k0 = p[0][0] / s;
+    float k1 = p[1][0] / s;
+    float innovation = accelPitch - pitch;
+    pitch += k0 * innovation;
+    bias += k1 * innovation;
+
+    float p00 = p[0][0];
+    float p01 = p[0][1];
+    p[0][0] -= k0 * p00;
+    p[0][1] -= k0 * p01;
+    p[1][0] -= k1 * p00;
+    p[1][1] -= k1 * p01;
+    return pitch;
+}
+
+float AttitudeFilter::accelPitch(int16_t ax, int16_t ay, int16_t az)
+{
+    return atan2f(ax, sqrtf((float)ay * ay + (float)az * az)) * RAD_TO_DEGREES;
+}
+
+float AttitudeFilter::gyroRate(int16_t gy, float lsbPerDps)
+{
+    // Positive rotation about Y tips the X axis down, which lowers the pitch
+    return -gy / lsbPerDps;
+}
@@ -0,0 +1,49 @@
+#ifndef ATTITUDEFILTER_H
+#define ATTITUDEFILTER_H
+
+#include <stdint.h>
+
+// Pitch estimation from raw accel/gyro samples (IMU_MODE_RAW).
+// Angles in degrees, rates in degrees per second, same sign convention as
+// the DMP pitch (ypr[1]). Plain C++ so the host bench can build it.
+
+enum AttitudeFilterType
+{
+    FILTER_COMPLEMENTARY,
+    FILTER_KALMAN
+};
+
+class AttitudeFilter
+{
+public:
+    AttitudeFilter(AttitudeFilterType type = FILTER_COMPLEMENTARY);
+
+    void setType(AttitudeFilterType type);
+    void setTimeConstant(float seconds);
+    void reset(float pitch);
+
+    // Fuse one sample taken dt seconds after the previous one; returns pitch
+    float update(float accelPitch, float gyroRate, float dt);
+
+    float getPitch() { return pitch; }
+    float getRate() { return rate; }
+
+    // Pitch from an accel sample and pitch rate from a gyro sample (any full scale)
+    static float accelPitch(int16_t ax, int16_t ay, int16_t az);
+    static float gyroRate(int16_t gy, float lsbPerDps);
+
+private:
+    AttitudeFilterType type;
+    bool started;
+    float pitch;
+    float rate;
+
+    // Complementary: how long the gyro is trusted over the accel
+    float timeConstant;
+
+    // Kalman: state is pitch and gyro bias
+    float bias;
+    float p[2][2];
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "Calibration.h"
+#include <Preferences.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+static const char *NVS_NAMESPACE = "imu";
+static const char *NVS_KEY = "cal";
+
+static const float TEMP_POINT_MERGE = 1.0;  // A calibration this close (deg C) replaces the old point
+static const float TEMP_MODEL_MIN_SPAN = 3; // Points must span this much (deg C) before the slope is trusted
+static const float TEMP_MODEL_MARGIN = 10;  // How far (deg C) past the calibrated range to extrapolate
+
+// Read the stored offsets; false (cal untouched) if none are stored or the layout changed.
+// Records from before the temperature model load with no points.
+bool loadCalibration(ImuCalibration *cal)
+{
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true))
+        return false;
+
+    ImuCalibration stored;
+    memset(&stored, 0, sizeof(stored));
+    size_t length = prefs.getBytesLength(NVS_KEY);
+    bool ok = (length == sizeof(stored) || length == offsetof(ImuCalibration, points)) &&
+              prefs.getBytes(NVS_KEY, &stored, length) == length;
+    prefs.end();
+    if (ok && stored.points > CALIBRATION_TEMP_POINTS)
+        ok = false;
+    if (ok)
+        *cal = stored;
+    return ok;
+}
+
+bool saveCalibration(const ImuCalibration *cal)
+{
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, false))
+        return false;
+
+    bool ok = prefs.putBytes(NVS_KEY, cal, sizeof(*cal)) == sizeof(*cal);
+    prefs.end();
+    return ok;
+}
+
+// Points are kept oldest first, so a refreshed point moves to the end
+static void removeGyroTempPoint(ImuCalibration *cal, uint8_t index)
+{
+    memmove(&cal->point[index], &cal->point[index + 1], sizeof(cal->point[0]) * (cal->points - index - 1));
+    cal->points--;
+}
+
+void addGyroTempPoint(ImuCalibration *cal, float temperature)
+{
+    // A calibration at about the same temperature replaces the old point
+    for (uint8_t i = 0; i < cal->points; i++)
+    {
+        if (fabsf(cal->point[i].temperature - temperature) < TEMP_POINT_MERGE)
+        {
+            removeGyroTempPoint(cal, i);
+            break;
+        }
+    }
+
+    // Full: drop the oldest
+    if (cal->points == CALIBRATION_TEMP_POINTS)
+        removeGyroTempPoint(cal, 0);
+
+    uint8_t slot = cal->points++;
+    cal->point[slot].temperature = temperature;
+    memcpy(cal->point[slot].gyro, cal->gyro, sizeof(cal->gyro));
+}
+
+bool gyroOffsetsAt(const ImuCalibration *cal, float temperature, int16_t *gyro)
+{
+    if (cal->points < 2)
+        return false;
+
+    float meanT = 0, minT = cal->point[0].temperature, maxT = minT;
+    for (uint8_t i = 0; i < cal->points; i++)
+    {
+        float t = cal->point[i].temperature;
+        meanT += t;
+        minT = fminf(minT, t);
+        maxT = fmaxf(maxT, t);
+    }
+    meanT /= cal->points;
+    if (maxT - minT < TEMP_MODEL_MIN_SPAN)
+        return false;
+
+    temperature = fminf(fmaxf(temperature, minT - TEMP_MODEL_MARGIN), maxT + TEMP_MODEL_MARGIN);
+
+    // Least-squares line per axis
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        float meanG = 0;
+        for (uint8_t i = 0; i < cal->points; i++)
+            meanG += cal->point[i].gyro[axis];
+        meanG /= cal->points;
+
+        float sxy = 0, sxx = 0;
+        for (uint8_t i = 0; i < cal->points; i++)
+        {
+            float dt = cal->point[i].temperature - meanT;
+            sxy += dt * (cal->point[i].gyro[axis] - meanG);
+            sxx += dt * dt;
+        }
+        gyro[axis] = (int16_t)lroundf(meanG + sxy / sxx * (temperature - meanT));
+    }
+    return true;
+}
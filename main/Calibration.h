@@ -0,0 +1,34 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+
+#define CALIBRATION_TEMP_POINTS 6 // Gyro calibrations kept for the temperature model
+
+// Gyro offsets from one calibration, at the MPU6050 die temperature (deg C)
+struct GyroTempPoint
+{
+    float temperature;
+    int16_t gyro[3];
+};
+
+// MPU6050 offset registers, in the units of setXGyroOffset()/setXAccelOffset() etc.
+struct ImuCalibration
+{
+    int16_t gyro[3];
+    int16_t accel[3];
+
+    // Gyro calibrations at different temperatures, oldest first
+    uint8_t points;
+    GyroTempPoint point[CALIBRATION_TEMP_POINTS];
+};
+
+bool loadCalibration(ImuCalibration *cal);
+bool saveCalibration(const ImuCalibration *cal);
+
+// Record cal->gyro as measured at this temperature
+void addGyroTempPoint(ImuCalibration *cal, float temperature);
+// Gyro offsets for this temperature from a line fitted through the points; false without a usable model
+bool gyroOffsetsAt(const ImuCalibration *cal, float temperature, int16_t *gyro);
+
+#endif
@@ -0,0 +1,157 @@
+#include "LoopTiming.h"
+#include <math.h>
+
+// Readers retry while TaskPID is mid-update; give up rather than spin forever
+static const uint8_t READ_ATTEMPTS = 8;
+
+LoopTiming::LoopTiming()
+    : rateHz(0), cyclesPerUs(1), period(0), havePrevious(false), pending(false), lastStart(0), currentStart(0),
+      sequence(0), resetRequested(false)
+{
+    clear();
+}
+
+void LoopTiming::setRate(uint16_t hz, uint32_t cyclesPerSecond)
+{
+    havePrevious = false;
+    pending = false;
+
+    sequence++;
+    __sync_synchronize();
+    rateHz = hz;
+    cyclesPerUs = cyclesPerSecond / 1000000;
+    if (cyclesPerUs == 0)
+        cyclesPerUs = 1;
+    period = hz ? cyclesPerSecond / hz : 0;
+    clear();
+    __sync_synchronize();
+    sequence++;
+}
+
+void LoopTiming::restart()
+{
+    havePrevious = false;
+    pending = false;
+}
+
+void LoopTiming::clear()
+{
+    cycles = 0;
+    periods = 0;
+    periodSum = 0;
+    periodMin = UINT32_MAX;
+    periodMax = 0;
+    jitterCount = 0;
+    jitterSquares = 0;
+    jitterMax = 0;
+    latencySum = 0;
+    latencyMax = 0;
+    overruns = 0;
+    skipped = 0;
+    unscheduled = 0;
+}
+
+void LoopTiming::start(uint32_t stamp, bool scheduled)
+{
+    sequence++;
+    __sync_synchronize();
+    if (resetRequested)
+    {
+        clear();
+        resetRequested = false;
+    }
+
+    // A polled sample's stamp is when we looked, not when it was taken, so it
+    // says nothing about the period and breaks the chain to the next one
+    if (!scheduled)
+    {
+        unscheduled++;
+        havePrevious = false;
+    }
+    else if (havePrevious)
+    {
+        uint32_t elapsed = stamp - lastStart; // Wraps cleanly every ~18 s at 240 MHz
+        periods++;
+        periodSum += elapsed;
+        if (elapsed < periodMin)
+            periodMin = elapsed;
+        if (elapsed > periodMax)
+            periodMax = elapsed;
+
+        if (period && elapsed > period + period / 2)
+        {
+            skipped += (elapsed + period / 2) / period - 1;
+        }
+        else if (period)
+        {
+            uint32_t deviation = elapsed > period ? elapsed - period : period - elapsed;
+            jitterCount++;
+            jitterSquares += (uint64_t)deviation * deviation;
+            if (deviation > jitterMax)
+                jitterMax = deviation;
+        }
+    }
+    if (scheduled)
+    {
+        lastStart = stamp;
+        havePrevious = true;
+    }
+    __sync_synchronize();
+    sequence++;
+
+    currentStart = stamp;
+    pending = true;
+}
+
+void LoopTiming::finish(uint32_t stamp)
+{
+    if (!pending)
+        return;
+    pending = false;
+    uint32_t latency = stamp - currentStart;
+
+    sequence++;
+    __sync_synchronize();
+    cycles++;
+    latencySum += latency;
+    if (latency > latencyMax)
+        latencyMax = latency;
+    if (period && latency > period)
+        overruns++;
+    __sync_synchronize();
+    sequence++;
+}
+
+bool LoopTiming::read(LoopStats *stats, bool reset)
+{
+    for (uint8_t attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+    {
+        uint32_t before = sequence;
+        __sync_synchronize();
+        if (before & 1)
+            continue;
+
+        float us = (float)cyclesPerUs;
+        stats->rateHz = rateHz;
+        stats->cycles = cycles;
+        stats->periodMin = periods ? periodMin / us : 0;
+        stats->periodMean = periods ? periodSum / periods / us : 0;
+        stats->periodMax = periodMax / us;
+        stats->jitterRms = jitterCount ? sqrtf((float)jitterSquares / jitterCount) / us : 0;
+        stats->jitterMax = jitterMax / us;
+        stats->latencyMean = cycles ? latencySum / cycles / us : 0;
+        stats->latencyMax = latencyMax / us;
+        stats->overruns = overruns;
+        stats->skipped = skipped;
+        stats->unscheduled = unscheduled;
+
+        __sync_synchronize();
+        if (sequence == before)
+        {
+            if (reset)
+                resetRequested = true;
+            return true;
+        }
+    }
+    return false;
+}
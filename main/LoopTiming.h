@@ -0,0 +1,79 @@
+#ifndef LOOPTIMING_H
+#define LOOPTIMING_H
+
+#include <stdint.h>
+
+// Period, jitter and deadline statistics for TaskPID. Each control cycle is
+// timestamped with the CPU cycle counter when its sample arrives (in the
+// MPU_INT ISR) and again once the motors are set. Written by TaskPID only;
+// read() may be called from any task without blocking the control loop.
+// Plain C++ so host tools can build it.
+
+// Snapshot in microseconds, since the last rate change or reset
+struct LoopStats
+{
+    uint16_t rateHz;       // Expected sample rate
+    uint32_t cycles;       // Control cycles timed
+    float periodMin;       // Between consecutive samples
+    float periodMean;
+    float periodMax;
+    float jitterRms;       // Period deviation from 1/rateHz, excluding skipped samples
+    float jitterMax;
+    float latencyMean;     // Sample arrival to motors set
+    float latencyMax;
+    uint32_t overruns;     // Cycles that finished after the next sample was due
+    uint32_t skipped;      // Samples that never started a cycle (period over 1.5x)
+    uint32_t unscheduled;  // Cycles started by polling instead of MPU_INT
+};
+
+class LoopTiming
+{
+public:
+    LoopTiming();
+
+    // Expected rate and CPU clock; clears the statistics
+    void setRate(uint16_t hz, uint32_t cyclesPerSecond);
+    uint16_t getRate() { return rateHz; }
+    // Forget the previous sample after a gap (IMU restart, sleep) without clearing
+    void restart();
+
+    // TaskPID: a sample arrived at this cycle count (scheduled = from MPU_INT)
+    void start(uint32_t stamp, bool scheduled);
+    // TaskPID: the outputs for the sample are applied
+    void finish(uint32_t stamp);
+
+    // Any task: consistent copy of the statistics, optionally starting a fresh window
+    bool read(LoopStats *stats, bool reset = false);
+
+private:
+    void clear();
+
+    uint16_t rateHz;
+    uint32_t cyclesPerUs;
+    uint32_t period;       // Expected period in CPU cycles
+
+    // TaskPID only
+    bool havePrevious;
+    bool pending;
+    uint32_t lastStart;
+    uint32_t currentStart;
+
+    // Shared with readers, guarded by sequence (odd while TaskPID writes)
+    volatile uint32_t sequence;
+    volatile bool resetRequested;
+    uint32_t cycles;
+    uint32_t periods;
+    uint64_t periodSum;
+    uint32_t periodMin;
+    uint32_t periodMax;
+    uint32_t jitterCount;
+    uint64_t jitterSquares;
+    uint32_t jitterMax;
+    uint64_t latencySum;
+    uint32_t latencyMax;
+    uint32_t overruns;
+    uint32_t skipped;
+    uint32_t unscheduled;
+};
+
+#endif
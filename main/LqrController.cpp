@@ -0,0 +1,71 @@
+#include "LqrController.h"
+
+LqrController::LqrController(const float gains[4])
+    : outMin(-255), outMax(255), positionLimit(0.3f), acceleration(0), feedforward(0)
+{
+    setGains(gains);
+    reset();
+}
+
+void LqrController::setGains(const float newGains[4])
+{
+    for (int i = 0; i < 4; i++)
+        gains[i] = newGains[i];
+}
+
+void LqrController::setOutputLimits(float min, float max)
+{
+    if (min >= max)
+        return;
+    outMin = min;
+    outMax = max;
+}
+
+void LqrController::setPositionLimit(float meters)
+{
+    positionLimit = meters;
+}
+
+void LqrController::setAccelerationLimit(float metersPerSecond2)
+{
+    acceleration = metersPerSecond2;
+}
+
+void LqrController::setFeedforward(float outputPerMps)
+{
+    feedforward = outputPerMps;
+}
+
+void LqrController::reset()
+{
+    target = 0;
+    position = 0;
+    output = 0;
+}
+
+float LqrController::update(float lean, float leanRate, float targetSpeed, float speed, float dt)
+{
+    // Ramp the target so a new command does not kick the robot over
+    float change = targetSpeed - target;
+    float limit = acceleration * dt;
+    if (acceleration > 0 && change > limit)
+        change = limit;
+    else if (acceleration > 0 && change < -limit)
+        change = -limit;
+    target += change;
+
+    float speedError = speed - target;
+    position += speedError * dt;
+    if (position > positionLimit)
+        position = positionLimit;
+    else if (position < -positionLimit)
+        position = -positionLimit;
+
+    output = feedforward * target -
+             (gains[0] * lean + gains[1] * leanRate + gains[2] * position + gains[3] * speedError);
+    if (output > outMax)
+        output = outMax;
+    else if (output < outMin)
+        output = outMin;
+    return output;
+}
@@ -0,0 +1,51 @@
+#ifndef LQRCONTROLLER_H
+#define LQRCONTROLLER_H
+
+// Full-state feedback balance controller, the alternative to the PID path,
+// selected at runtime with the CONTROLLER command (PID is the default). In
+// util/host/lqr_design it settles slower than the PID path after a push or a
+// STOP, as the position state is dead-reckoned from the speed estimate and
+// drifts; the switch is there to compare them on the robot. The output is
+// -K x, with x made of:
+//   lean (deg, forward of the balance setpoint),
+//   lean rate (deg/s),
+//   wheel position error (m),
+//   wheel speed error (m/s).
+// K comes from util/host/lqr_design, which solves the discrete LQR problem
+// for the robot's physical parameters. Wheel speed is the
+// WheelSpeedEstimator's. Position is the integral of speed minus the
+// commanded speed, so the robot holds its place when stopped and keeps up
+// with a moving target; it is clamped so a stalled wheel does not wind it
+// up. Plain C++ so host tools can build it.
+class LqrController
+{
+public:
+    explicit LqrController(const float gains[4]);
+
+    void setGains(const float gains[4]);
+    void setOutputLimits(float min, float max);
+    void setPositionLimit(float meters);
+    void setAccelerationLimit(float metersPerSecond2); // 0 = step the target
+    void setFeedforward(float outputPerMps);           // Drive for a speed before feedback trims it
+    void reset();
+
+    // One step; output in the same units as the gains (PWM, -255..255)
+    float update(float lean, float leanRate, float targetSpeed, float speed, float dt);
+
+    float getOutput() { return output; }
+    float getPosition() { return position; }
+    float getTarget() { return target; } // Target after the acceleration limit
+
+private:
+    float gains[4];
+    float outMin, outMax;
+    float positionLimit;
+    float acceleration;
+    float feedforward;
+
+    float target;
+    float position;
+    float output;
+};
+
+#endif
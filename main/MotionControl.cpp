@@ -2,56 +2,471 @@
 #include "MotionControl.h"
 #include "MotorControl.h"
 #include "I2Cdev.h"
-#include <PID_v1.h>
+#include "I2CdevBus.h"
+#include "PidController.h"
 #include "MPU6050_6Axis_MotionApps20.h"
-#include <Wire.h>
+#include "AttitudeFilter.h"
+#include "Calibration.h"
+#include "StageProfiler.h"
+#include "SpeedController.h"
+#include "LqrController.h"
+#ifdef PID_BENCHMARK
+#include <PID_v1.h>
+#endif
 
 MPU6050 mpu; // Initialize MPU6050 object
-bool dmpReady = false;
-uint8_t mpuIntStatus;
+uint8_t imuMode = IMU_MODE;
+bool imuReady = false;
 uint16_t packetSize;
 uint16_t fifoCount;
 uint8_t fifoBuffer[64];
-Quaternion q;
-VectorFloat gravity;
-float ypr[3];
+AttitudeFilter attitudeFilter(IMU_RAW_FILTER);
+float pitchRate = 0; // deg/s, from the DMP gyro or the raw-mode filter
+
+float originalSetpoint = 190;
+float setpoint = 190;
+float Kp = 25.0, Kd = 1.2, Ki = 80.0; // PID Constants
+float input, output;
+PidController pid(Kp, Ki, Kd); // D acts on the measured pitchRate
+const float PID_D_FILTER = 0.005; // Low-pass on the D input (s), ~32 Hz
+const float PID_MAX_DT = 0.05;    // Longest step the PID takes after a gap (s)
+
+// Speed loop (SPEED_CONTROL), cascaded onto the balance PID: it runs at
+// SPEED_LOOP_RATE on the estimated wheel speed and moves the setpoint by up
+// to SPEED_MAX_TILT. Tuned on util/host/cascade_sim, which has the same wiring.
+const float SPEED_LOOP_RATE = 50;      // Hz, outer loop; the balance loop runs at the IMU rate
+const float SPEED_KP = 20.0, SPEED_KI = 20.0; // deg of lean per m/s of speed error
+const float SPEED_FEEDFORWARD = 4.0;   // deg of lean per m/s of target
+const float SPEED_MAX_TILT = 8.0;      // deg
+const float SPEED_ACCEL_LIMIT = 0.5;   // m/s^2 ramp on the target
+const float DRIVE_SPEED = 0.3;         // m/s for FORWARD/REVERSE
+const float DRIVE_TILT = 4.0;          // moveOffset of FORWARD/REVERSE, mapped to DRIVE_SPEED
+const float MOTOR_NO_LOAD_SPEED = 0.8; // m/s at full PWM, wheels off the ground
+const float MOTOR_LEAN_LOAD = 9.0;     // PWM per deg of lean spent holding the body up
+const float SPEED_ESTIMATE_TIME = 1.0; // s, accelerometer to motor model crossover
+const float IMU_HEIGHT = 0.1;          // m, IMU above the axle
+const float ACCEL_LSB_PER_G = 8192;    // DMP FIFO accel, and raw mode at MPU6050_ACCEL_FS_4
+SpeedController speedLoop(SPEED_KP, SPEED_KI, SPEED_MAX_TILT, SPEED_LOOP_RATE);
+WheelSpeedEstimator wheelSpeed(MOTOR_NO_LOAD_SPEED, SPEED_ESTIMATE_TIME, MOTOR_LEAN_LOAD, IMU_HEIGHT);
+float forwardAccel = 0; // m/s^2, horizontal, from the sample being processed
+float lastDrive = 0;    // Balance output sent to the motors last cycle, before turnOffset
+#ifdef BATTERY_PIN
+const unsigned long BATTERY_INTERVAL = 100; // ms between supply reads
+const float BATTERY_SMOOTHING = 0.2;        // Low-pass per read, ~0.5 s
+unsigned long lastBatteryRead = 0;
+float batteryVolts = BATTERY_FULL;
+#endif
+
+// LQR mode (CONTROLLER_LQR), from util/host/lqr_design with its default weights.
+// Takes the same FORWARD/REVERSE speed targets as the speed loop.
+const float LQR_GAINS[4] = {-54.70, -3.501, -954.0, -964.0}; // PWM per deg, deg/s, m, m/s
+const float LQR_FEEDFORWARD = 396;                           // PWM per m/s of target
+LqrController lqr(LQR_GAINS);
+uint8_t controllerMode = BALANCE_CONTROLLER;
+
+// Offsets of the original board, used until a calibration is stored in NVS.
+// Accel X/Y are filled in from the chip's factory trim at boot.
+ImuCalibration imuCalibration = {{-2, 74, 7}, {0, 0, 968}};
+bool calibrationRequested = false;
+bool calibrateAccel = false;
 
-double originalSetpoint = 190;
-volatile double setpoint = 190;
-double Kp = 25.0, Kd = 1.2, Ki = 80.0; // PID Constants
-double input, output;
-PID pid(&input, &output, (double *)&setpoint, Kp, Ki, Kd, DIRECT);
+// Gyro temperature compensation (see updateGyroCompensation())
+const unsigned long GYRO_COMP_INTERVAL = 1000; // ms between die temperature reads
+const float GYRO_COMP_HYSTERESIS = 0.25;       // deg C change before the offsets are recomputed
+int16_t gyroOffsetApplied[3];                  // What the gyro offset registers hold
+int16_t gyroOffsetTarget[3];
+uint8_t gyroOffsetPending = 3;                 // Next axis to write, 3 = none
+float gyroCompTemperature = NAN;
+unsigned long lastTemperatureRead = 0;
 
 unsigned long fallenStartTime = 0;
 const unsigned long SLEEP_TIMEOUT = 10000; // Duration of light sleep
+const uint8_t FIFO_WAIT_POLLS = 10;                       // FIFO count polls for a signalled packet before giving up
+const unsigned long IMU_FAULT_TIMEOUT = 50;               // Cut the motors after this many ms without a good packet
+const TickType_t MPU_INT_TIMEOUT = pdMS_TO_TICKS(30);     // Poll the MPU anyway if INT stays quiet this long (loose wire)
+const uint32_t MPU_INT_NOTIFY_BIT = 1UL << 0;             // TaskPID notification bit set by the MPU_INT ISR
+const uint8_t DMP_FIFO_LAYOUT = MPU6050_DMP_FIFO_GYRO | MPU6050_DMP_FIFO_ACCEL; // Accel for the wheel speed estimate: 42-byte packets
+const uint16_t IMU_RATE_ACTIVE = 200;                     // DMP packets per second while balancing
+const uint16_t IMU_RATE_IDLE = 50;                        // DMP packets per second while fallen
+const uint16_t IMU_RAW_RATE_ACTIVE = 1000;                // Raw samples per second while balancing
+const uint16_t IMU_RAW_RATE_IDLE = 50;                    // Raw samples per second while fallen
+const float IMU_RAW_GYRO_LSB = 65.5;                      // LSB per deg/s at MPU6050_GYRO_FS_500
+const unsigned long IMU_RAW_MAX_DT = 50000;               // Cap on the filter step after a gap (us)
+unsigned long lastPacketTime = 0;
+unsigned long lastRawSampleTime = 0;
+volatile unsigned long mpuIntTime = 0;  // micros() at the last MPU_INT pulse
+volatile uint32_t mpuIntCycles = 0;     // CPU cycle count at the last MPU_INT pulse (ISR and TaskPID share core 1)
+unsigned long sampleTime = 0;           // When the sample being processed was taken
+uint32_t sampleCycles = 0;
+bool sampleScheduled = false;           // Sample came with an MPU_INT pulse, not from polling
+LoopTiming loopTiming;                  // Period, jitter and deadline misses of TaskPID
+unsigned long lastSampleTime = 0;
+uint16_t rawRate = 0;
+uint32_t skippedPackets = 0; // DMP packets dropped to catch up with the newest one
+uint32_t fifoOverflows = 0;  // FIFO resets after FIFO_OFLOW
+
+static TaskHandle_t pidTask = NULL;
+
+#ifdef TASKPID_PROFILE
+// Where a TaskPID cycle spends its time, from the MPU_INT pulse to the end of upkeep
+enum TaskPidStage
+{
+    STAGE_WAKE,     // MPU_INT pulse to TaskPID running (~0 when polled)
+    STAGE_POLL,     // FIFO count reads
+    STAGE_READ,     // FIFO packet / getMotion6 transfer
+    STAGE_COMMANDS, // handleCommands()
+    STAGE_ATTITUDE, // Pitch and pitch rate from the sample
+    STAGE_CONTROL,  // Balance controller step (speed loop and PID, or LQR)
+    STAGE_MOTORS,   // setMotorSpeed()
+    STAGE_UPKEEP,   // IMU rate, gyro temperature compensation and battery reads
+    STAGE_COUNT
+};
+static const char *const stageNames[STAGE_COUNT] = {"wake", "poll", "read", "commands", "attitude", "pid", "motors", "upkeep"};
+static StageProfiler profiler(stageNames, STAGE_COUNT, 240000000);
+#define PROFILE_BEGIN(stamp) profiler.begin(stamp)
+#define PROFILE_MARK(stage) profiler.mark(stage, ESP.getCycleCount())
+#define PROFILE_END() profiler.end()
+#define PROFILE_CANCEL() profiler.cancel()
+#else
+#define PROFILE_BEGIN(stamp)
+#define PROFILE_MARK(stage)
+#define PROFILE_END()
+#define PROFILE_CANCEL()
+#endif
+
+// MPU_INT pulses once per DMP packet; wake TaskPID to read it
+static void IRAM_ATTR onMpuInterrupt()
+{
+    mpuIntCycles = ESP.getCycleCount();
+    mpuIntTime = micros();
+    if (pidTask == NULL)
+        return;
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(pidTask, MPU_INT_NOTIFY_BIT, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static float readDieTemperature()
+{
+    return mpu.getTemperature() / 340.0f + 36.53f;
+}
+
+// Offsets and MPU_INT pin setup shared by both IMU modes
+static void applyImuConfig()
+{
+    // Calibrated gyro offsets, moved to the current temperature if there is a model
+    memcpy(gyroOffsetApplied, imuCalibration.gyro, sizeof(gyroOffsetApplied));
+    gyroCompTemperature = readDieTemperature();
+    gyroOffsetsAt(&imuCalibration, gyroCompTemperature, gyroOffsetApplied);
+    gyroOffsetPending = 3;
+    lastTemperatureRead = millis();
+
+    mpu.setXGyroOffset(gyroOffsetApplied[0]);
+    mpu.setYGyroOffset(gyroOffsetApplied[1]);
+    mpu.setZGyroOffset(gyroOffsetApplied[2]);
+    mpu.setXAccelOffset(imuCalibration.accel[0]);
+    mpu.setYAccelOffset(imuCalibration.accel[1]);
+    mpu.setZAccelOffset(imuCalibration.accel[2]);
+    mpu.setInterruptMode(MPU6050_INTMODE_ACTIVEHIGH);
+    mpu.setInterruptDrive(MPU6050_INTDRV_PUSHPULL);
+    mpu.setInterruptLatch(MPU6050_INTLATCH_50USPULSE);
+}
+
+// Bring the DMP up (reusing resident firmware when the MPU kept it) and apply our offsets
+static bool startDmp()
+{
+    if (mpu.dmpResume() != 0)
+        return false;
+
+    applyImuConfig();
+    mpu.setDMPEnabled(true);
+    packetSize = mpu.dmpGetFIFOPacketSize();
+    return true;
+}
+
+// Configure the sensor for raw 1 kHz sampling with DATA_RDY on MPU_INT
+static bool startRaw()
+{
+    uint32_t errorsBefore = I2Cdev::errors;
+    mpu.setDMPEnabled(false);
+    mpu.setClockSource(MPU6050_CLOCK_PLL_XGYRO);
+    mpu.setFullScaleGyroRange(MPU6050_GYRO_FS_500);
+    mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_4);
+    mpu.setDLPFMode(MPU6050_DLPF_BW_188); // ~2 ms group delay instead of ~4.8 ms at BW_42
+    rawRate = 0;                          // Force setImuRate() to program the divider
+    applyImuConfig();
+    mpu.setIntEnabled(1 << MPU6050_INTERRUPT_DATA_RDY_BIT);
+    attitudeFilter.setType(IMU_RAW_FILTER); // Restart from the accel angle
+    return I2Cdev::errors == errorsBefore;
+}
+
+static bool startImu(const char *reason)
+{
+    unsigned long start = micros();
+    bool ok = imuMode == IMU_MODE_RAW ? startRaw() : startDmp();
+    if (!ok)
+        return false;
+
+    lastPacketTime = millis();
+    lastSampleTime = micros();
+    loopTiming.restart();
+    pid.reset();
+    speedLoop.reset();
+    lqr.reset();
+    wheelSpeed.reset();
+    lastDrive = 0;
+    if (imuMode == IMU_MODE_RAW)
+        Serial.printf("IMU ready (raw) %lu us after %s\n", micros() - start, reason);
+    else
+        Serial.printf("IMU ready %lu us after %s (firmware upload %lu us)\n", micros() - start, reason, (unsigned long)mpu.dmpUploadTime);
+    return true;
+}
+
+// Follow the gyro temperature model as the robot warms up. Runs after the
+// motors are set and does at most one short register access per control
+// cycle, so it never holds up the next sample.
+static void updateGyroCompensation()
+{
+    // Finish writing a new set of offsets, skipping axes that did not change
+    while (gyroOffsetPending < 3 && gyroOffsetTarget[gyroOffsetPending] == gyroOffsetApplied[gyroOffsetPending])
+        gyroOffsetPending++;
+    if (gyroOffsetPending < 3)
+    {
+        uint8_t axis = gyroOffsetPending++;
+        if (axis == 0)
+            mpu.setXGyroOffset(gyroOffsetTarget[0]);
+        else if (axis == 1)
+            mpu.setYGyroOffset(gyroOffsetTarget[1]);
+        else
+            mpu.setZGyroOffset(gyroOffsetTarget[2]);
+        gyroOffsetApplied[axis] = gyroOffsetTarget[axis];
+        return;
+    }
+
+    if (imuCalibration.points < 2 || millis() - lastTemperatureRead < GYRO_COMP_INTERVAL)
+        return;
+    lastTemperatureRead = millis();
+    float temperature = readDieTemperature();
+    if (fabsf(temperature - gyroCompTemperature) < GYRO_COMP_HYSTERESIS)
+        return;
+    if (gyroOffsetsAt(&imuCalibration, temperature, gyroOffsetTarget))
+    {
+        gyroCompTemperature = temperature;
+        gyroOffsetPending = 0;
+    }
+}
+
+#ifdef BATTERY_PIN
+// Supply voltage for the wheel speed estimate's motor model
+static void updateBatteryCompensation()
+{
+    if (millis() - lastBatteryRead < BATTERY_INTERVAL)
+        return;
+    lastBatteryRead = millis();
+    float volts = analogReadMilliVolts(BATTERY_PIN) * (BATTERY_DIVIDER / 1000);
+    // Under half charge is a loose divider or USB power: keep the last reading
+    if (volts < BATTERY_FULL / 2)
+        return;
+    batteryVolts += (volts - batteryVolts) * BATTERY_SMOOTHING;
+    wheelSpeed.setSupply(batteryVolts / BATTERY_FULL);
+}
+#endif
+
+// Change the IMU output rate, which is the control loop rate; the PID follows the sample timestamps
+static bool setImuRate(uint16_t hz)
+{
+    bool ok = true;
+    if (imuMode == IMU_MODE_RAW)
+    {
+        // Sample rate is 1 kHz / (1 + divider) with the DLPF on
+        if (rawRate != hz)
+        {
+            mpu.setRate(1000 / hz - 1);
+            rawRate = hz;
+        }
+    }
+    else
+    {
+        ok = mpu.dmpGetSampleFrequency() == hz || mpu.dmpSetFIFORate(MPU6050_DMP_SAMPLE_RATE / hz - 1) == 0;
+    }
+
+    // Loop statistics are kept per rate
+    if (ok && loopTiming.getRate() != hz)
+        loopTiming.setRate(hz, getCpuFrequencyMhz() * 1000000UL);
+    return ok;
+}
+
+// Offsets from NVS, or the defaults above if this board was never calibrated
+static void loadImuCalibration()
+{
+    if (loadCalibration(&imuCalibration))
+    {
+        Serial.printf("IMU calibration loaded (%u temperature points)\n", imuCalibration.points);
+        return;
+    }
+    imuCalibration.accel[0] = mpu.getXAccelOffset();
+    imuCalibration.accel[1] = mpu.getYAccelOffset();
+    Serial.println("No stored IMU calibration, using defaults");
+}
+
+// Stream calibration progress to the serial console
+static void onCalibrationPass(const MPU6050CalibrationProgress *progress, void *arg)
+{
+    Serial.printf("Calibration pass %u/%u: accel bias %.1f %.1f %.1f, gyro bias %.1f %.1f %.1f\n",
+                  progress->pass, progress->passes, progress->bias[0], progress->bias[1], progress->bias[2],
+                  progress->bias[3], progress->bias[4], progress->bias[5]);
+}
+
+// Find new offsets with the robot held still (and flat, Z up, for accel), store them and restart the IMU
+static void calibrateImu(bool accel)
+{
+    setMotorSpeed(0, 0);
+    Serial.println(accel ? "Calibrating gyro and accel..." : "Calibrating gyro...");
+    unsigned long start = millis();
+
+    uint8_t sensors = MPU6050_CALIBRATE_GYRO | (accel ? MPU6050_CALIBRATE_ACCEL : 0);
+    uint8_t status = mpu.calibrateOffsets(sensors, MPU6050_CALIBRATION_SAMPLES, MPU6050_CALIBRATION_PASSES, onCalibrationPass, NULL);
+
+    ImuCalibration cal = imuCalibration;
+    cal.gyro[0] = mpu.getXGyroOffset();
+    cal.gyro[1] = mpu.getYGyroOffset();
+    cal.gyro[2] = mpu.getZGyroOffset();
+    float temperature = readDieTemperature();
+    if (accel)
+    {
+        cal.accel[0] = mpu.getXAccelOffset();
+        cal.accel[1] = mpu.getYAccelOffset();
+        cal.accel[2] = mpu.getZAccelOffset();
+    }
+
+    // Not converging means the robot moved; keep the old offsets rather than store a bad set
+    if (status != 0)
+    {
+        Serial.println(status == 2 ? "IMU calibration failed (bus errors), keeping the old offsets"
+                                   : "IMU calibration did not settle (robot moved?), keeping the old offsets");
+    }
+    else
+    {
+        addGyroTempPoint(&cal, temperature);
+        imuCalibration = cal;
+        Serial.printf("IMU calibration %s in %lu ms: gyro %d %d %d at %.1f C (%u temperature points), accel %d %d %d\n",
+                      saveCalibration(&cal) ? "saved" : "NOT saved", millis() - start,
+                      cal.gyro[0], cal.gyro[1], cal.gyro[2], temperature, cal.points,
+                      cal.accel[0], cal.accel[1], cal.accel[2]);
+    }
+
+    fifoCount = 0;
+    imuReady = startImu("calibration");
+}
+
+#ifdef I2C_CLOCK_BENCHMARK
+// Time one DMP packet read at each I2C clock, to pick I2C_CLOCK from data
+static void benchmarkImuBus()
+{
+    const uint32_t clocks[] = {100000, 400000, 1000000};
+    for (uint32_t clock : clocks)
+    {
+        if (!I2Cdev::setClock(clock))
+            continue;
+        uint32_t us = I2Cdev::benchmarkRead(MPU6050_DEFAULT_ADDRESS, MPU6050_RA_FIFO_R_W, 42, 100);
+        Serial.printf("I2C %lu Hz: %lu us per FIFO packet read\n", (unsigned long)clock, (unsigned long)us);
+    }
+    I2Cdev::setClock(I2C_CLOCK);
+}
+#endif
+
+#ifdef PID_BENCHMARK
+// CPU cycles per controller step, PidController against PID_v1
+static void benchmarkPid()
+{
+    const uint16_t STEPS = 200;
+    double v1Input = 190, v1Output = 0, v1Setpoint = 190;
+    PID v1(&v1Input, &v1Output, &v1Setpoint, Kp, Ki, Kd, DIRECT);
+    v1.SetOutputLimits(-255, 255);
+    v1.SetSampleTime(1);
+    v1.SetMode(AUTOMATIC);
+    PidController controller(Kp, Ki, Kd);
+    controller.setDerivativeFilter(PID_D_FILTER);
+
+    uint32_t v1Cycles = 0, v1Steps = 0, cycles = 0;
+    for (uint16_t i = 0; i < STEPS; i++)
+    {
+        v1Input = 190 + 5 * sin(i * 0.05);
+        delay(1); // PID_v1 only computes once its sample time has passed
+        uint32_t start = ESP.getCycleCount();
+        bool computed = v1.Compute();
+        uint32_t elapsed = ESP.getCycleCount() - start;
+        if (computed)
+        {
+            v1Cycles += elapsed;
+            v1Steps++;
+        }
+
+        start = ESP.getCycleCount();
+        controller.update(190, (float)v1Input, 0.001f);
+        cycles += ESP.getCycleCount() - start;
+    }
+    Serial.printf("PID step: PID_v1 %lu cycles, PidController %lu cycles\n",
+                  (unsigned long)(v1Steps ? v1Cycles / v1Steps : 0), (unsigned long)(cycles / STEPS));
+}
+#endif
 
 void initMotion()
 {
-    Wire.begin(SDA_PIN, SCL_PIN); // Connect to pin 21 and 22
-    Wire.setClock(400000); // Set I2C clock to 400kHz
+    if (!I2Cdev::initialize(I2C_PORT, (gpio_num_t)SDA_PIN, (gpio_num_t)SCL_PIN, I2C_CLOCK))
+        Serial.println("I2C init failed");
+#ifdef I2C_CLOCK_BENCHMARK
+    benchmarkImuBus();
+#endif
+#ifdef PID_BENCHMARK
+    benchmarkPid();
+#endif
+    mpu.setRegisterShadowEnabled(true); // Skip the read half of bit-level config writes
     mpu.initialize();
+    loadImuCalibration();
+
+    pinMode(MPU_INT, INPUT);
+    attachInterrupt(digitalPinToInterrupt(MPU_INT), onMpuInterrupt, RISING);
+
+#ifdef TASKPID_PROFILE
+    profiler.setClock(getCpuFrequencyMhz() * 1000000UL);
+#endif
+    pid.setOutputLimits(-255, 255);
+    pid.setDerivativeFilter(PID_D_FILTER);
+    speedLoop.setAccelerationLimit(SPEED_ACCEL_LIMIT);
+    speedLoop.setFeedforward(SPEED_FEEDFORWARD);
+    lqr.setAccelerationLimit(SPEED_ACCEL_LIMIT);
+    lqr.setFeedforward(LQR_FEEDFORWARD);
 
-    if (mpu.dmpInitialize() == 0)
+    mpu.dmpSetFIFOLayout(DMP_FIFO_LAYOUT); // Kept by startDmp() across cold and warm starts
+    if (startImu("boot"))
     {
-        mpu.setXGyroOffset(-2);
-        mpu.setYGyroOffset(74);
-        mpu.setZGyroOffset(7);
-        mpu.setZAccelOffset(968);
-        mpu.setDMPEnabled(true);
-        dmpReady = true;
-        packetSize = mpu.dmpGetFIFOPacketSize();
-        pid.SetMode(AUTOMATIC);
-        pid.SetSampleTime(10);
-        pid.SetOutputLimits(-255, 255);
+        imuReady = true;
+        setImuRate(imuMode == IMU_MODE_RAW ? IMU_RAW_RATE_ACTIVE : IMU_RATE_ACTIVE);
     }
     else
     {
-        Serial.println("DMP Failed");
+        Serial.println(imuMode == IMU_MODE_RAW ? "IMU Failed" : "DMP Failed");
     }
 
     pinMode(BUTTON_PIN, INPUT_PULLUP); // Set button pin as input with pull-up for wake-up
 }
 
+bool readLoopStats(LoopStats *stats, bool reset)
+{
+    return loopTiming.read(stats, reset);
+}
+
+#ifdef TASKPID_PROFILE
+size_t dumpTaskProfile(char *buf, size_t size, bool reset)
+{
+    size_t length = profiler.dump(buf, size);
+    if (reset)
+        profiler.reset();
+    return length;
+}
+#endif
+
 void playbackTimerCallback(TimerHandle_t xTimer)
 {
     if (!isPlaying)
@@ -89,61 +504,226 @@ void playbackTimerCallback(TimerHandle_t xTimer)
     }
 }
 
-void TaskPID(void *pvParameters)
+// Apply the latest command from the network task, if any
+static void handleCommands()
 {
     RobotCommand receivedPkg;
-    for (;;)
+    if (xQueueReceive(commandQueue, &receivedPkg, 0) == pdTRUE)
     {
-        if (xQueueReceive(commandQueue, &receivedPkg, 0) == pdTRUE)
+        if (receivedPkg.type == 0)
         {
-            if (receivedPkg.type == 0)
-            {
-                moveOffset = 0;
-                turnOffset = 0;
-            }
-            else if (receivedPkg.type == 1)
-            {
-                moveOffset = receivedPkg.val;
-                turnOffset = 0;
-            }
-            else if (receivedPkg.type == 2)
+            moveOffset = 0;
+            turnOffset = 0;
+        }
+        else if (receivedPkg.type == 1)
+        {
+            moveOffset = receivedPkg.val;
+            turnOffset = 0;
+        }
+        else if (receivedPkg.type == 2)
+        {
+            turnOffset = receivedPkg.val;
+        }
+        else if (receivedPkg.type == 3)
+        {
+            // Run by TaskPID between reads, never with a transfer in flight
+            calibrationRequested = true;
+            calibrateAccel = receivedPkg.val != 0;
+        }
+        else if (receivedPkg.type == 4)
+        {
+            // Each controller starts from rest rather than from the other's state
+            uint8_t mode = receivedPkg.val == CONTROLLER_LQR ? CONTROLLER_LQR : CONTROLLER_PID;
+            if (mode != controllerMode)
             {
-                turnOffset = receivedPkg.val;
+                controllerMode = mode;
+                pid.reset();
+                speedLoop.reset();
+                lqr.reset();
+                Serial.println(mode == CONTROLLER_LQR ? "Balance controller: LQR" : "Balance controller: PID");
             }
         }
+    }
+}
 
-        if (!dmpReady)
-        {
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-            continue;
-        }
+// Wait for the next DMP packet and turn it into input; false if there is none this cycle
+static bool readDmpSample()
+{
+    // Sleep until the DMP has a packet, unless the last pass left one in the FIFO
+    uint32_t notified = 0;
+    if (fifoCount < packetSize)
+        xTaskNotifyWait(0, MPU_INT_NOTIFY_BIT, &notified, MPU_INT_TIMEOUT);
+    PROFILE_BEGIN((notified & MPU_INT_NOTIFY_BIT) ? mpuIntCycles : ESP.getCycleCount());
+    PROFILE_MARK(STAGE_WAKE);
 
-        mpuIntStatus = mpu.getIntStatus();
-        fifoCount = mpu.getFIFOCount();
+    // Any failed transaction below (counted by I2Cdev) invalidates this cycle.
+    // INT_STATUS is read, which clears it, once per pass. In 50 us pulse
+    // mode with INT_RD_CLEAR off nothing else clears it, and whether MPU_INT
+    // keeps pulsing while DMP_INT stays set is not something to rely on.
+    // FIFO_OFLOW is also the only sign the FIFO overwrote bytes: the count
+    // alone can still look like whole packets.
+    uint32_t errorsBefore = I2Cdev::errors;
+    uint8_t intStatus = mpu.getIntStatus();
+    fifoCount = mpu.getFIFOCount();
+    PROFILE_MARK(STAGE_POLL);
 
-        if ((mpuIntStatus & 0x10) || fifoCount == 1024)
+    bool packetReady = false;
+    if (I2Cdev::errors != errorsBefore)
+    {
+        // Bus already recovered by I2Cdev; try again next cycle
+    }
+    else if (intStatus & (1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT))
+    {
+        // The oldest bytes were overwritten, so packet boundaries are lost
+        mpu.resetFIFO();
+        fifoCount = 0;
+        fifoOverflows++;
+    }
+    else if ((notified & MPU_INT_NOTIFY_BIT) || fifoCount >= packetSize)
+    {
+        for (uint8_t i = 0; fifoCount < packetSize && i < FIFO_WAIT_POLLS && I2Cdev::errors == errorsBefore; i++)
+            fifoCount = mpu.getFIFOCount();
+        PROFILE_MARK(STAGE_POLL);
+
+        if (fifoCount > packetSize && I2Cdev::errors == errorsBefore)
         {
-            mpu.resetFIFO();
+            // Fell behind: drain in bursts and act on the newest packet only
+            uint16_t skipped = 0;
+            packetReady = mpu.dmpGetLatestFIFOPacket(fifoBuffer, &skipped, fifoCount) == 0;
+            skippedPackets += skipped;
+            fifoCount %= packetSize; // Part of the next packet stays in the FIFO
         }
-        else if (mpuIntStatus & 0x02)
+        else if (fifoCount == packetSize && I2Cdev::errors == errorsBefore)
         {
-            while (fifoCount < packetSize)
-                fifoCount = mpu.getFIFOCount();
+            // Read in TaskPID: the only work that could overlap the transfer is a
+            // queue poll, not worth a worker task and two context switches
             mpu.getFIFOBytes(fifoBuffer, packetSize);
             fifoCount -= packetSize;
+            packetReady = true;
+        }
+    }
+
+    PROFILE_MARK(STAGE_READ);
+
+    handleCommands();
+    PROFILE_MARK(STAGE_COMMANDS);
+
+    if (I2Cdev::errors != errorsBefore)
+        packetReady = false;
+    if (!packetReady)
+        return false;
+
+    sampleScheduled = (notified & MPU_INT_NOTIFY_BIT) != 0;
+    sampleTime = sampleScheduled ? mpuIntTime : micros();
+    sampleCycles = sampleScheduled ? mpuIntCycles : ESP.getCycleCount();
+    float pitch, rate;
+    mpu.dmpGetPitch(&pitch, fifoBuffer);
+    input = pitch + 180;
+    if (mpu.dmpGetPitchRate(&rate, fifoBuffer) == 0)
+        pitchRate = rate;
+    int16_t accel[3];
+    if (mpu.dmpGetAccel(accel, fifoBuffer) == 0)
+        forwardAccel = WheelSpeedEstimator::forwardAccel(accel[0], accel[2], ACCEL_LSB_PER_G, pitch);
+    PROFILE_MARK(STAGE_ATTITUDE);
+    return true;
+}
+
+// Wait for DATA_RDY, read one accel/gyro sample and fuse it into input and pitchRate
+static bool readRawSample()
+{
+    uint32_t notified = 0;
+    xTaskNotifyWait(0, MPU_INT_NOTIFY_BIT, &notified, MPU_INT_TIMEOUT);
+    PROFILE_BEGIN((notified & MPU_INT_NOTIFY_BIT) ? mpuIntCycles : ESP.getCycleCount());
+    PROFILE_MARK(STAGE_WAKE);
+
+    uint32_t errorsBefore = I2Cdev::errors;
+    int16_t ax, ay, az, gx, gy, gz;
+    mpu.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
+    bool scheduled = (notified & MPU_INT_NOTIFY_BIT) != 0;
+    unsigned long now = scheduled ? mpuIntTime : micros();
+    uint32_t nowCycles = scheduled ? mpuIntCycles : ESP.getCycleCount();
+    PROFILE_MARK(STAGE_READ);
+
+    handleCommands();
+    PROFILE_MARK(STAGE_COMMANDS);
+
+    if (I2Cdev::errors != errorsBefore)
+        return false;
+
+    sampleTime = now;
+    sampleCycles = nowCycles;
+    sampleScheduled = scheduled;
+    unsigned long dt = now - lastRawSampleTime;
+    lastRawSampleTime = now;
+    if (dt > IMU_RAW_MAX_DT)
+        dt = IMU_RAW_MAX_DT;
+
+    attitudeFilter.update(AttitudeFilter::accelPitch(ax, ay, az), AttitudeFilter::gyroRate(gy, IMU_RAW_GYRO_LSB), dt * 1e-6f);
+    input = attitudeFilter.getPitch() + 180;
+    pitchRate = attitudeFilter.getRate();
+    forwardAccel = WheelSpeedEstimator::forwardAccel(ax, az, ACCEL_LSB_PER_G, attitudeFilter.getPitch());
+    PROFILE_MARK(STAGE_ATTITUDE);
+    return true;
+}
+
+void TaskPID(void *pvParameters)
+{
+    pidTask = xTaskGetCurrentTaskHandle();
+    for (;;)
+    {
+        if (calibrationRequested)
+        {
+            calibrationRequested = false;
+            calibrateImu(calibrateAccel);
+        }
+
+        if (!imuReady)
+        {
+            handleCommands();
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        bool packetReady = imuMode == IMU_MODE_RAW ? readRawSample() : readDmpSample();
 
-            mpu.dmpGetQuaternion(&q, fifoBuffer);
-            mpu.dmpGetGravity(&gravity, &q);
-            mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
-            input = ypr[1] * 180 / M_PI + 180;
+        if (packetReady)
+            lastPacketTime = millis();
+        else if (millis() - lastPacketTime > IMU_FAULT_TIMEOUT)
+            setMotorSpeed(0, 0); // Don't keep driving on a stale attitude
 
-            // PID Control
-            setpoint = originalSetpoint + moveOffset;
+        if (packetReady)
+        {
+            loopTiming.start(sampleCycles, sampleScheduled);
+
+            // PID Control, stepped by the time between IMU samples
+            float dt = (sampleTime - lastSampleTime) * 1e-6f;
+            lastSampleTime = sampleTime;
+            if (dt > PID_MAX_DT)
+                dt = PID_MAX_DT;
             if (!isnan(input))
-                pid.Compute();
+            {
+                float lean = originalSetpoint - input;
+                wheelSpeed.update(lastDrive, lean, -pitchRate, forwardAccel, dt);
+                float targetSpeed = -moveOffset * (DRIVE_SPEED / DRIVE_TILT);
+                if (controllerMode == CONTROLLER_LQR)
+                {
+                    output = lqr.update(lean, -pitchRate, targetSpeed, wheelSpeed.getSpeed(), dt);
+                }
+                else
+                {
+#if SPEED_CONTROL
+                    // FORWARD/REVERSE ask for a speed; the speed loop picks the lean
+                    setpoint = originalSetpoint + speedLoop.update(targetSpeed, wheelSpeed.getSpeed(), dt);
+#else
+                    setpoint = originalSetpoint + moveOffset;
+#endif
+                    output = pid.update(setpoint, input, pitchRate, dt);
+                }
+            }
+            PROFILE_MARK(STAGE_CONTROL);
 
-            double currentOutput = output;
-            if (abs(currentOutput) < 10)
+            float currentOutput = output;
+            if (fabsf(currentOutput) < 10)
                 currentOutput = 0;
             int left = currentOutput + turnOffset;
             int right = currentOutput - turnOffset;
@@ -152,24 +732,43 @@ void TaskPID(void *pvParameters)
             if (input < 140 || input > 230)
             {
                 setMotorSpeed(0, 0);
+                speedLoop.reset(); // Start from rest when picked up
+                lqr.reset();
+                wheelSpeed.reset();
+                lastDrive = 0;
+                PROFILE_MARK(STAGE_MOTORS);
+                loopTiming.finish(ESP.getCycleCount());
+                setImuRate(imuMode == IMU_MODE_RAW ? IMU_RAW_RATE_IDLE : IMU_RATE_IDLE);
                 if (fallenStartTime == 0)
                     fallenStartTime = millis();
                 if (millis() - fallenStartTime > SLEEP_TIMEOUT)
                 {
+                    PROFILE_CANCEL();
                     Serial.println("Entering Sleep...");
                     delay(100);
                     esp_sleep_enable_ext0_wakeup((gpio_num_t)BUTTON_PIN, 0);
                     esp_light_sleep_start();
                     Serial.println("Woke up!");
+                    imuReady = startImu("wake");
                     fallenStartTime = 0;
                 }
             }
             else
             {
                 setMotorSpeed(left, right);
+                lastDrive = currentOutput;
+                PROFILE_MARK(STAGE_MOTORS);
+                loopTiming.finish(ESP.getCycleCount());
+                setImuRate(imuMode == IMU_MODE_RAW ? IMU_RAW_RATE_ACTIVE : IMU_RATE_ACTIVE);
                 fallenStartTime = 0;
             }
+
+            updateGyroCompensation();
+#ifdef BATTERY_PIN
+            updateBatteryCompensation();
+#endif
+            PROFILE_MARK(STAGE_UPKEEP);
+            PROFILE_END();
         }
-        vTaskDelay(1 / portTICK_PERIOD_MS);
     }
-}
\ No newline at end of file
+}
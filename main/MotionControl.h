@@ -2,9 +2,17 @@
 #define MOTIONCONTROL_H
 
 #include "freertos/timers.h"
+#include "LoopTiming.h"
+#include "StageProfiler.h"
 
 void initMotion();
 void TaskPID(void *pvParameters);
 void playbackTimerCallback(TimerHandle_t xTimer);
+// TaskPID period/jitter/deadline statistics; safe from any task
+bool readLoopStats(LoopStats *stats, bool reset);
+#ifdef TASKPID_PROFILE
+// Per-stage TaskPID timing as JSON (PROFILE_DUMP_SIZE fits); safe from any task
+size_t dumpTaskProfile(char *buf, size_t size, bool reset);
+#endif
 
 #endif
\ No newline at end of file
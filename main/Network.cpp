@@ -3,12 +3,51 @@
 #include <WiFi.h>
 #include <WebSocketsServer.h>
 #include <ArduinoJson.h>
+#include "I2Cdev.h"
+#include "MotionControl.h"
 
 // Setup AP ssid and password
 const char *ssid = "iphone bryan";
 const char *password = "bryan123";
 WebSocketsServer webSocket = WebSocketsServer(80); // Set port for websocket
 
+#ifdef I2CDEV_TRACE
+// Reply with the I2C transaction trace, then start a fresh one
+static void sendI2CTrace(uint8_t num)
+{
+    static char trace[I2CDEV_TRACE_DUMP_SIZE];
+    if (I2Cdev::traceDump(trace, sizeof(trace)) > 0)
+        webSocket.sendTXT(num, trace);
+    I2Cdev::traceReset();
+}
+#endif
+
+// Reply with TaskPID's loop timing (microseconds); "reset": true starts a fresh window
+static void sendLoopStats(uint8_t num, bool reset)
+{
+    LoopStats stats;
+    if (!readLoopStats(&stats, reset))
+        return;
+    char json[320];
+    snprintf(json, sizeof(json),
+             "{\"rate\":%u,\"cycles\":%lu,\"period\":[%.1f,%.1f,%.1f],\"jitter_rms\":%.1f,\"jitter_max\":%.1f,"
+             "\"latency_mean\":%.1f,\"latency_max\":%.1f,\"overruns\":%lu,\"skipped\":%lu,\"unscheduled\":%lu}",
+             stats.rateHz, (unsigned long)stats.cycles, stats.periodMin, stats.periodMean, stats.periodMax,
+             stats.jitterRms, stats.jitterMax, stats.latencyMean, stats.latencyMax, (unsigned long)stats.overruns,
+             (unsigned long)stats.skipped, (unsigned long)stats.unscheduled);
+    webSocket.sendTXT(num, json);
+}
+
+#ifdef TASKPID_PROFILE
+// Reply with where TaskPID spends each cycle; "reset": true starts a fresh window
+static void sendTaskProfile(uint8_t num, bool reset)
+{
+    static char profile[PROFILE_DUMP_SIZE];
+    if (dumpTaskProfile(profile, sizeof(profile), reset) > 0)
+        webSocket.sendTXT(num, profile);
+}
+#endif
+
 void onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length)
 {
     switch (type)
@@ -24,6 +63,45 @@ void onWebSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t lengt
         String command = doc["command"];
         bool record = doc["record"];
 
+        // Diagnostics are answered here and never recorded or queued
+        if (command == "I2C_TRACE")
+        {
+#ifdef I2CDEV_TRACE
+            sendI2CTrace(num);
+#endif
+            break;
+        }
+        if (command == "LOOP_STATS")
+        {
+            sendLoopStats(num, doc["reset"]);
+            break;
+        }
+        if (command == "PROFILE")
+        {
+#ifdef TASKPID_PROFILE
+            sendTaskProfile(num, doc["reset"]);
+#endif
+            break;
+        }
+
+        // Re-calibrate the IMU (robot held still; "accel": true also needs it flat, Z up)
+        if (command == "CALIBRATE")
+        {
+            bool accel = doc["accel"];
+            RobotCommand pkg = {3, accel ? 1.0f : 0.0f};
+            xQueueSend(commandQueue, &pkg, 0);
+            break;
+        }
+
+        // Switch the balance controller ("mode": "PID" or "LQR"), e.g. to A/B test them
+        if (command == "CONTROLLER")
+        {
+            String mode = doc["mode"];
+            RobotCommand pkg = {4, (float)(mode == "LQR" ? CONTROLLER_LQR : CONTROLLER_PID)};
+            xQueueSend(commandQueue, &pkg, 0);
+            break;
+        }
+
         if (xSemaphoreTake(dataMutex, portMAX_DELAY) == pdTRUE)
         {
             if (record && !isCurrentlyRecording)
@@ -0,0 +1,93 @@
+#include "PidController.h"
+
+PidController::PidController(float kp, float ki, float kd)
+    : kp(kp), ki(ki), kd(kd), outMin(-255), outMax(255), filterTime(0)
+{
+    reset();
+}
+
+void PidController::setTunings(float newKp, float newKi, float newKd)
+{
+    kp = newKp;
+    ki = newKi;
+    kd = newKd;
+}
+
+void PidController::setOutputLimits(float min, float max)
+{
+    outMin = min;
+    outMax = max;
+    if (integral > outMax)
+        integral = outMax;
+    else if (integral < outMin)
+        integral = outMin;
+}
+
+void PidController::setDerivativeFilter(float timeConstant)
+{
+    filterTime = timeConstant;
+}
+
+// Start over: no integral, and no derivative kick from the first sample
+void PidController::reset()
+{
+    started = false;
+    integral = 0;
+    rateFiltered = 0;
+    lastMeasurement = 0;
+    output = 0;
+}
+
+void PidController::scaleIntegral(float factor)
+{
+    integral *= factor;
+}
+
+float PidController::update(float setpoint, float measurement, float rate, float dt)
+{
+    lastMeasurement = measurement;
+    if (!started)
+    {
+        started = true;
+        rateFiltered = rate;
+    }
+    return step(setpoint - measurement, rate, dt);
+}
+
+float PidController::update(float setpoint, float measurement, float dt)
+{
+    float rate = 0;
+    if (started && dt > 0)
+        rate = (measurement - lastMeasurement) / dt;
+    return update(setpoint, measurement, rate, dt);
+}
+
+float PidController::step(float error, float rate, float dt)
+{
+    // First-order low-pass on the derivative input
+    if (filterTime > 0)
+        rateFiltered += (rate - rateFiltered) * dt / (filterTime + dt);
+    else
+        rateFiltered = rate;
+
+    float proportional = kp * error;
+    float derivative = -kd * rateFiltered;
+
+    // Anti-windup: stop integrating while the output is saturated in the
+    // direction the error would push it, and never hold more than the limits
+    float candidate = integral + ki * error * dt;
+    float unclamped = proportional + candidate + derivative;
+    if (!((unclamped > outMax && error > 0) || (unclamped < outMin && error < 0)))
+        integral = candidate;
+    if (integral > outMax)
+        integral = outMax;
+    else if (integral < outMin)
+        integral = outMin;
+
+    output = proportional + integral + derivative;
+    if (output > outMax)
+        output = outMax;
+    else if (output < outMin)
+        output = outMin;
+    return output;
+}
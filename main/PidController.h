@@ -0,0 +1,41 @@
+#ifndef PIDCONTROLLER_H
+#define PIDCONTROLLER_H
+
+// Single-precision PID with an explicit time step (seconds), for the ESP32 FPU.
+// Same sign conventions as PID_v1 in DIRECT mode: proportional on error,
+// derivative on measurement, ki and kd per second. Plain C++ so the host
+// bench can build it.
+class PidController
+{
+public:
+    PidController(float kp, float ki, float kd);
+
+    void setTunings(float kp, float ki, float kd);
+    void setOutputLimits(float min, float max);
+    void setDerivativeFilter(float timeConstant); // seconds, 0 = unfiltered
+    void reset();
+    void scaleIntegral(float factor); // e.g. when the load the integral was built up against drops
+
+    // One step; rate is the measured d(measurement)/dt, e.g. from a gyro
+    float update(float setpoint, float measurement, float rate, float dt);
+    // One step, differentiating the measurement
+    float update(float setpoint, float measurement, float dt);
+
+    float getOutput() { return output; }
+    float getIntegral() { return integral; }
+
+private:
+    float step(float error, float rate, float dt);
+
+    float kp, ki, kd;
+    float outMin, outMax;
+    float filterTime;
+
+    bool started;
+    float integral;
+    float rateFiltered;
+    float lastMeasurement;
+    float output;
+};
+
+#endif
@@ -17,8 +17,37 @@
 #define MPU_INT 19
 #define SDA_PIN 21
 #define SCL_PIN 22
+#define I2C_PORT I2C_NUM_0
+#define I2C_CLOCK 400000 // Up to 1000000 with external pull-ups; see I2C_CLOCK_BENCHMARK
+// #define I2C_CLOCK_BENCHMARK // Print FIFO packet read time at each I2C clock on boot
+// #define PID_BENCHMARK // Print PidController and PID_v1 cycles per step on boot
+// #define TASKPID_PROFILE // Per-stage cycle counts for TaskPID, read with the PROFILE command
 #define BUTTON_PIN 0
 
+// Attitude source, chosen at boot
+#define IMU_MODE_DMP 0 // DMP quaternion at up to 200 Hz
+#define IMU_MODE_RAW 1 // getMotion6 at up to 1 kHz, fused on the ESP32 by AttitudeFilter
+#define IMU_MODE IMU_MODE_DMP
+#define IMU_RAW_FILTER FILTER_COMPLEMENTARY // or FILTER_KALMAN
+
+// Drive control
+#define SPEED_CONTROL 1 // FORWARD/REVERSE set a wheel speed held by an outer loop; 0 = lean the setpoint by moveOffset
+// The wheel speed estimate (speed loop and LQR) needs accel in every DMP
+// packet, so packets are 42 bytes even with SPEED_CONTROL 0 while the LQR
+// can be selected; the PID's D term needs the gyro either way.
+// The speed loop's wheel speed estimate has a motor model that scales with
+// the supply. Without BATTERY_PIN it assumes a full charge, and on a low
+// battery the robot holds a speed short of the target by about the voltage
+// drop (0.22 m/s for 0.30 at 80% in util/host/cascade_sim).
+// #define BATTERY_PIN 35  // ADC1 pin on a divider from the motor supply (ADC2 is taken by WiFi)
+#define BATTERY_DIVIDER 4.0 // Supply volts per volt at BATTERY_PIN
+#define BATTERY_FULL 8.4    // Motor supply at full charge (V)
+
+// Balance controller, switched at runtime with the CONTROLLER command
+#define CONTROLLER_PID 0 // Pitch PID (with the speed loop under SPEED_CONTROL)
+#define CONTROLLER_LQR 1 // Full-state feedback on pitch, pitch rate and wheel position/speed
+#define BALANCE_CONTROLLER CONTROLLER_PID // At boot
+
 #define PWM_FREQ 5000
 #define PWM_RESOLUTION 8
 #define PWM_CHANNEL_A 0
@@ -27,7 +56,7 @@
 // Data Structures
 struct RobotCommand
 {
-    int type; // 0=Stop, 1=Move, 2=Turn
+    int type; // 0=Stop, 1=Move, 2=Turn, 3=Calibrate IMU (val 1 = accel too), 4=Balance controller (val CONTROLLER_*)
     float val;
 };
 
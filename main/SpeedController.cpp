@@ -0,0 +1,121 @@
+#include "SpeedController.h"
+#include <math.h>
+
+static const float G = 9.80665f;
+static const float DEG_TO_RAD = 0.01745329f;
+
+WheelSpeedEstimator::WheelSpeedEstimator(float maxSpeed, float timeConstant, float leanLoad, float sensorHeight)
+    : maxSpeed(maxSpeed), timeConstant(timeConstant), leanLoad(leanLoad), sensorHeight(sensorHeight), supply(1)
+{
+    reset();
+}
+
+void WheelSpeedEstimator::setModel(float newMaxSpeed, float newTimeConstant, float newLeanLoad, float newSensorHeight)
+{
+    maxSpeed = newMaxSpeed;
+    timeConstant = newTimeConstant;
+    leanLoad = newLeanLoad;
+    sensorHeight = newSensorHeight;
+}
+
+void WheelSpeedEstimator::setSupply(float relative)
+{
+    supply = relative;
+}
+
+void WheelSpeedEstimator::reset()
+{
+    sensorSpeed = 0;
+    speed = 0;
+}
+
+float WheelSpeedEstimator::update(float drive, float lean, float leanRate, float accel, float dt)
+{
+    // Speed per PWM follows the supply; leaning forward takes forward torque
+    // that does not turn into speed, and that torque costs the same current
+    // (so the same PWM times voltage) at any supply
+    float model = (drive * supply - leanLoad * lean) * (maxSpeed / 255);
+
+    // The IMU also moves as the body rocks about the axle
+    float swing = sensorHeight * leanRate * DEG_TO_RAD * cosf(lean * DEG_TO_RAD);
+    sensorSpeed += accel * dt + (model + swing - sensorSpeed) * dt / (timeConstant + dt);
+    speed = sensorSpeed - swing;
+    return speed;
+}
+
+float WheelSpeedEstimator::forwardAccel(int16_t ax, int16_t az, float lsbPerG, float pitch)
+{
+    // Rotate the specific force into the horizontal; gravity drops out
+    float p = pitch * DEG_TO_RAD;
+    return (ax * cosf(p) - az * sinf(p)) * (G / lsbPerG);
+}
+
+SpeedController::SpeedController(float kp, float ki, float maxTilt, float hz)
+    : pid(kp, ki, 0), acceleration(0), feedforward(0), elapsed(0), target(0), tilt(0)
+{
+    setRate(hz);
+    setMaxTilt(maxTilt);
+}
+
+void SpeedController::setTunings(float kp, float ki)
+{
+    pid.setTunings(kp, ki, 0);
+}
+
+void SpeedController::setRate(float hz)
+{
+    period = 1 / hz;
+}
+
+void SpeedController::setMaxTilt(float degrees)
+{
+    pid.setOutputLimits(-degrees, degrees);
+}
+
+void SpeedController::setAccelerationLimit(float metersPerSecond2)
+{
+    acceleration = metersPerSecond2;
+}
+
+void SpeedController::setFeedforward(float degreesPerMps)
+{
+    feedforward = degreesPerMps;
+}
+
+void SpeedController::reset()
+{
+    pid.reset();
+    elapsed = 0;
+    target = 0;
+    tilt = 0;
+}
+
+float SpeedController::update(float targetSpeed, float speed, float dt)
+{
+    elapsed += dt;
+    if (elapsed < period)
+        return tilt;
+    float step = elapsed;
+    elapsed = 0;
+
+    // Ramp the target so a new command does not kick the robot over
+    float change = targetSpeed - target;
+    float limit = acceleration * step;
+    if (acceleration > 0 && change > limit)
+        change = limit;
+    else if (acceleration > 0 && change < -limit)
+        change = -limit;
+    float previous = target;
+    target += change;
+
+    // What the integral holds is mostly lean against drag, which shrinks
+    // with speed: scale it down with the target so a stop does not carry
+    // the cruising lean and creep on
+    if (previous * target >= 0 && fabsf(target) < fabsf(previous))
+        pid.scaleIntegral(target / previous);
+
+    // Going faster forward needs a forward lean, which is a lower balance
+    // setpoint: measurement and setpoint swap to flip the sign
+    tilt = pid.update(speed, target, step) - feedforward * target;
+    return tilt;
+}
@@ -0,0 +1,80 @@
+#ifndef SPEEDCONTROLLER_H
+#define SPEEDCONTROLLER_H
+
+#include <stdint.h>
+#include "PidController.h"
+
+// Outer loop of the cascaded drive control (SPEED_CONTROL): regulates wheel
+// speed (m/s, forward positive) by handing the balance PID a tilt offset in
+// degrees, added to its setpoint like moveOffset. Runs at its own rate, below
+// the IMU rate: update() may be called every balance cycle and recomputes
+// only once per period. Plain C++ so the host simulation can build it.
+
+// The robot has no wheel encoders, so speed is estimated by a complementary
+// filter: the IMU's horizontal acceleration, integrated, for fast changes,
+// pulled over timeConstant towards a DC motor model for the steady state.
+// The model is PWM, scaled by the supply voltage, minus the part spent
+// holding the current lean against gravity, times the no-load speed. Without
+// a supply reading (setSupply()) it assumes a full battery, and on a low one
+// the steady-state estimate reads fast by the voltage drop.
+class WheelSpeedEstimator
+{
+public:
+    // maxSpeed: ground speed at full PWM, no load (m/s); timeConstant: seconds;
+    // leanLoad: PWM per degree of lean the motors need just to hold it;
+    // sensorHeight: IMU above the axle (m), whose swing is not wheel speed
+    WheelSpeedEstimator(float maxSpeed, float timeConstant, float leanLoad, float sensorHeight);
+
+    void setModel(float maxSpeed, float timeConstant, float leanLoad, float sensorHeight);
+    void setSupply(float relative); // Motor supply over its full-charge voltage, 1 = full
+    void reset();
+
+    // drive: motor command as sent to setMotorSpeed() (-255..255, forward positive);
+    // lean, leanRate: degrees (per second) forward of the balance setpoint;
+    // accel: horizontal acceleration of the IMU, m/s^2 forward
+    float update(float drive, float lean, float leanRate, float accel, float dt);
+    float getSpeed() { return speed; }
+
+    // Horizontal acceleration (m/s^2, along +X) from an accel sample and the pitch
+    static float forwardAccel(int16_t ax, int16_t az, float lsbPerG, float pitch);
+
+private:
+    float maxSpeed;
+    float timeConstant;
+    float leanLoad;
+    float sensorHeight;
+    float supply;
+    float sensorSpeed; // Horizontal speed of the IMU
+    float speed;
+};
+
+class SpeedController
+{
+public:
+    SpeedController(float kp, float ki, float maxTilt, float hz);
+
+    void setTunings(float kp, float ki);
+    void setRate(float hz);
+    void setMaxTilt(float degrees);
+    void setAccelerationLimit(float metersPerSecond2); // 0 = step the target
+    void setFeedforward(float degreesPerMps);          // Lean for a speed before feedback trims it
+    void reset();
+
+    // Tilt offset for the balance setpoint; recomputed once per outer period
+    float update(float targetSpeed, float speed, float dt);
+
+    float getTilt() { return tilt; }
+    float getTarget() { return target; } // Target after the acceleration limit
+
+private:
+    PidController pid;
+    float period;
+    float acceleration;
+    float feedforward;
+
+    float elapsed;
+    float target;
+    float tilt;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "StageProfiler.h"
+#include <stdio.h>
+#include <string.h>
+
+// Readers retry while the loop is committing a cycle; give up rather than spin forever
+static const uint8_t READ_ATTEMPTS = 8;
+static const uint8_t FIRST_OCTAVE = 6;
+
+StageProfiler::StageProfiler(const char *const *names, uint8_t stages, uint32_t cyclesPerSecond)
+    : names(names), stages(stages > PROFILE_MAX_STAGES ? PROFILE_MAX_STAGES : stages), running(false), last(0),
+      touched(0), sequence(0), resetRequested(false)
+{
+    setClock(cyclesPerSecond);
+    clear();
+}
+
+void StageProfiler::setClock(uint32_t cyclesPerSecond)
+{
+    cyclesPerUs = cyclesPerSecond / 1000000;
+    if (cyclesPerUs == 0)
+        cyclesPerUs = 1;
+}
+
+void StageProfiler::clear()
+{
+    memset(count, 0, sizeof(count));
+    memset(sum, 0, sizeof(sum));
+    memset(max, 0, sizeof(max));
+    memset(histogram, 0, sizeof(histogram));
+    for (uint8_t i = 0; i < PROFILE_MAX_STAGES; i++)
+        min[i] = UINT32_MAX;
+}
+
+// Quarter-octave bucket: octave from the top bit, quarter from the two bits below it
+uint8_t StageProfiler::bucketOf(uint32_t cycles)
+{
+    if (cycles < (1UL << FIRST_OCTAVE))
+        return 0;
+    uint8_t octave = 31 - __builtin_clz(cycles);
+    if (octave >= FIRST_OCTAVE + PROFILE_BUCKETS / 4)
+        return PROFILE_BUCKETS - 1;
+    return (octave - FIRST_OCTAVE) * 4 + ((cycles >> (octave - 2)) & 3);
+}
+
+// Smallest cycle count above the bucket
+uint32_t StageProfiler::bucketLimit(uint8_t bucket)
+{
+    uint8_t octave = bucket / 4 + FIRST_OCTAVE;
+    return (uint32_t)(4 + bucket % 4 + 1) << (octave - 2);
+}
+
+void StageProfiler::begin(uint32_t stamp)
+{
+    running = true;
+    last = stamp;
+    touched = 0;
+}
+
+void StageProfiler::mark(uint8_t stage, uint32_t stamp)
+{
+    if (!running || stage >= stages)
+        return;
+    uint32_t elapsed = stamp - last;
+    last = stamp;
+    if (touched & (1 << stage))
+        current[stage] += elapsed;
+    else
+        current[stage] = elapsed;
+    touched |= 1 << stage;
+}
+
+void StageProfiler::end()
+{
+    if (!running)
+        return;
+    running = false;
+
+    sequence++;
+    __sync_synchronize();
+    if (resetRequested)
+    {
+        clear();
+        resetRequested = false;
+    }
+    for (uint8_t i = 0; i < stages; i++)
+    {
+        if (!(touched & (1 << i)))
+            continue;
+        uint32_t cycles = current[i];
+        count[i]++;
+        sum[i] += cycles;
+        if (cycles < min[i])
+            min[i] = cycles;
+        if (cycles > max[i])
+            max[i] = cycles;
+        histogram[i][bucketOf(cycles)]++;
+    }
+    __sync_synchronize();
+    sequence++;
+}
+
+void StageProfiler::reset()
+{
+    resetRequested = true;
+}
+
+bool StageProfiler::snapshot(uint8_t stage, StageStats *stats)
+{
+    if (stage >= stages)
+        return false;
+    for (uint8_t attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+    {
+        uint32_t before = sequence;
+        __sync_synchronize();
+        if (before & 1)
+            continue;
+
+        float us = (float)cyclesPerUs;
+        uint32_t n = count[stage];
+        stats->count = n;
+        stats->min = n ? min[stage] / us : 0;
+        stats->mean = n ? sum[stage] / n / us : 0;
+        stats->max = max[stage] / us;
+
+        // Walk the histogram once for all three percentiles
+        const uint8_t percents[3] = {50, 90, 99};
+        float *targets[3] = {&stats->p50, &stats->p90, &stats->p99};
+        uint8_t next = 0;
+        uint32_t seen = 0;
+        for (uint8_t b = 0; b < PROFILE_BUCKETS && next < 3 && n; b++)
+        {
+            seen += histogram[stage][b];
+            while (next < 3 && (uint64_t)seen * 100 >= (uint64_t)n * percents[next])
+                *targets[next++] = bucketLimit(b) / us;
+        }
+        while (next < 3)
+            *targets[next++] = 0;
+
+        __sync_synchronize();
+        if (sequence == before)
+            return true;
+    }
+    return false;
+}
+
+// Every stage as JSON, in microseconds; returns the length written, or 0 if
+// it does not fit, like I2Cdev::traceDump(), so a cut-off object is never sent
+size_t StageProfiler::dump(char *buf, size_t size)
+{
+    size_t used;
+    int n = snprintf(buf, size, "{\"stages\":[");
+    if (n < 0 || (size_t)n >= size)
+        return 0;
+    used = n;
+    bool first = true;
+    for (uint8_t i = 0; i < stages; i++)
+    {
+        StageStats stats;
+        if (!snapshot(i, &stats))
+            continue;
+        n = snprintf(buf + used, size - used,
+                     "%s{\"name\":\"%s\",\"count\":%lu,\"min\":%.1f,\"mean\":%.1f,\"max\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f}",
+                     first ? "" : ",", names[i], (unsigned long)stats.count, stats.min, stats.mean, stats.max,
+                     stats.p50, stats.p90, stats.p99);
+        if (n < 0 || (size_t)n >= size - used)
+            return 0;
+        used += n;
+        first = false;
+    }
+    n = snprintf(buf + used, size - used, "]}");
+    if (n < 0 || (size_t)n >= size - used)
+        return 0;
+    return used + n;
+}
@@ -0,0 +1,79 @@
+#ifndef STAGEPROFILER_H
+#define STAGEPROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-stage CPU cycle accounting for one loop (TaskPID, see TASKPID_PROFILE).
+// The loop calls begin() when a cycle starts, mark() at the end of each stage
+// and end() once the cycle is done; a stage may be marked more than once per
+// cycle and its pieces add up. Only cycles that reach end() are counted.
+// Written by the loop task only; snapshot() and dump() may be called from any
+// task and never block it. Plain C++ so host tools can build it.
+
+#define PROFILE_MAX_STAGES 8
+// Histogram buckets are a quarter octave wide, from 2^6 to 2^22 cycles
+// (0.27 us to 17 ms at 240 MHz); faster and slower stages land in the ends
+#define PROFILE_BUCKETS 64
+// Buffer size that always holds a full dump()
+#define PROFILE_DUMP_SIZE (64 + PROFILE_MAX_STAGES * 160)
+
+// One stage, in microseconds
+struct StageStats
+{
+    uint32_t count;
+    float min;
+    float mean;
+    float max;
+    float p50; // Percentiles are bucket upper edges, so at most ~19% high
+    float p90;
+    float p99;
+};
+
+class StageProfiler
+{
+public:
+    StageProfiler(const char *const *names, uint8_t stages, uint32_t cyclesPerSecond);
+
+    void setClock(uint32_t cyclesPerSecond);
+
+    // Loop task only
+    void begin(uint32_t stamp);
+    void mark(uint8_t stage, uint32_t stamp);
+    void end();
+    void cancel() { running = false; } // Drop the current cycle
+
+    // Any task
+    bool snapshot(uint8_t stage, StageStats *stats);
+    size_t dump(char *buf, size_t size);
+    void reset();
+
+    uint8_t getStages() { return stages; }
+    const char *getName(uint8_t stage) { return names[stage]; }
+
+private:
+    static uint8_t bucketOf(uint32_t cycles);
+    static uint32_t bucketLimit(uint8_t bucket);
+    void clear();
+
+    const char *const *names;
+    uint8_t stages;
+    uint32_t cyclesPerUs;
+
+    // Current cycle, loop task only
+    bool running;
+    uint32_t last;
+    uint8_t touched;                      // Bit per stage marked this cycle
+    uint32_t current[PROFILE_MAX_STAGES];
+
+    // Shared with readers, guarded by sequence (odd while the loop writes)
+    volatile uint32_t sequence;
+    volatile bool resetRequested;
+    uint32_t count[PROFILE_MAX_STAGES];
+    uint64_t sum[PROFILE_MAX_STAGES];
+    uint32_t min[PROFILE_MAX_STAGES];
+    uint32_t max[PROFILE_MAX_STAGES];
+    uint32_t histogram[PROFILE_MAX_STAGES][PROFILE_BUCKETS];
+};
+
+#endif
@@ -0,0 +1,357 @@
+// Host benchmark for the raw-sensor attitude mode (IMU_MODE_RAW) against the
+// DMP path.
+//
+// First it times AttitudeFilter (complementary and Kalman, including the
+// accel/gyro conversions) per sample, next to the quaternion to pitch math
+// the DMP path runs per packet: dmpGetPitch() and the dmpGetQuaternion() +
+// dmpGetGravity() + dmpGetYawPitchRoll() chain it replaced. Host time and
+// TSC cycles, so compare the rows rather than the absolute numbers. It also
+// checks dmpGetPitch() against that chain over a sweep of attitudes.
+//
+// Then it runs both acquisition paths against the emulated MPU6050 while the
+// emulated robot rocks +-10 deg at 2 Hz with a 2 deg/s gyro bias: the DMP path
+// at 200 Hz (quaternion-only packets, FIFO count + packet read per interrupt)
+// and the raw path at 1 kHz (one 14-byte getMotion6 burst per DATA_RDY,
+// fused on the host). Each run reports bus time per sample, the age of the
+// sample when the controller gets it, the pitch error against the emulated
+// truth, and the total latency with the datasheet DLPF delay of each
+// configuration added (the emulator does not filter).
+//
+// Usage: attitude_bench [clock_hz] [seconds]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "I2Cdev.h"
+#include "I2CdevBus.h"
+#include "MPU6050_6Axis_MotionApps20.h"
+#include "MPU6050_Emulator.h"
+#include "AttitudeFilter.h"
+
+// Gyro group delay from the MPU6050 datasheet (register 26)
+static const float DLPF_DELAY_BW_42_US = 4800;  // DMP configuration
+static const float DLPF_DELAY_BW_188_US = 1900; // raw configuration
+
+static const float SWING_DEGREES = 10;
+static const float SWING_HZ = 2;
+static const int16_t GYRO_BIAS_LSB = 262; // 2 deg/s at +-250 deg/s
+
+struct RunStats
+{
+    uint32_t samples;
+    uint64_t busUs;
+    uint64_t ageUs;
+    double errorSquares;
+    float worstError;
+};
+
+static volatile bool intPending = false;
+static uint64_t intTimeUs = 0;
+
+static void onInterrupt(void *arg)
+{
+    intPending = true;
+    intTimeUs = ((MPU6050Emulator *)arg)->getTimeUs();
+}
+
+static uint64_t wallNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Time stamp counter where there is one, nanoseconds otherwise
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return wallNs();
+#endif
+}
+
+static void printCost(const char *name, uint64_t startNs, uint64_t startCycles, uint32_t iterations)
+{
+    uint64_t ns = wallNs() - startNs;
+    uint64_t c = cycles() - startCycles;
+    printf("%-15s %6.1f ns/sample %6.1f cycles/sample\n", name, (double)ns / iterations, (double)c / iterations);
+}
+
+// Store a unit quaternion the way the DMP sends it (q30, big-endian)
+static void encodeQuaternion(uint8_t *packet, float w, float x, float y, float z)
+{
+    float q[4] = {w, x, y, z};
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        int32_t v = (int32_t)(q[i] * 1073741823.0f);
+        packet[4 * i] = v >> 24;
+        packet[4 * i + 1] = v >> 16;
+        packet[4 * i + 2] = v >> 8;
+        packet[4 * i + 3] = v;
+    }
+}
+
+// dmpInitialize() logs every step; keep it out of the report
+static uint8_t quietDmpInitialize(MPU6050 &mpu)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        return mpu.dmpInitialize();
+    uint8_t status = mpu.dmpInitialize();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return status;
+}
+
+// Pitch in the dmpGetYawPitchRoll() convention, and its rate
+static float truePitch(uint64_t us)
+{
+    return SWING_DEGREES * sinf(2 * M_PI * SWING_HZ * us * 1e-6f);
+}
+
+static float truePitchRate(uint64_t us)
+{
+    return SWING_DEGREES * 2 * M_PI * SWING_HZ * cosf(2 * M_PI * SWING_HZ * us * 1e-6f);
+}
+
+// Tilt the emulated sensor about Y; positive pitch is a negative rotation
+static void setMotion(MPU6050Emulator &emu, uint64_t us)
+{
+    float half = -truePitch(us) * M_PI / 360;
+    emu.setAttitude(cosf(half), 0, sinf(half), 0);
+    emu.setRotationRate(0, -truePitchRate(us), 0);
+}
+
+static void benchFilterCost()
+{
+    const uint32_t SAMPLES = 4096;
+    const uint32_t ITERATIONS = 2000000;
+    static int16_t ax[SAMPLES], ay[SAMPLES], az[SAMPLES], gy[SAMPLES];
+    for (uint32_t i = 0; i < SAMPLES; i++)
+    {
+        float pitch = truePitch(i * 1000) * M_PI / 180;
+        ax[i] = (int16_t)(8192 * sinf(pitch)) + rand() % 64 - 32;
+        ay[i] = rand() % 64 - 32;
+        az[i] = (int16_t)(8192 * cosf(pitch)) + rand() % 64 - 32;
+        gy[i] = (int16_t)(-truePitchRate(i * 1000) * 65.5f) + rand() % 32 - 16;
+    }
+
+    const char *names[] = {"complementary", "kalman"};
+    AttitudeFilterType types[] = {FILTER_COMPLEMENTARY, FILTER_KALMAN};
+    volatile float sink = 0;
+    for (uint8_t t = 0; t < 2; t++)
+    {
+        AttitudeFilter filter(types[t]);
+        uint64_t startNs = wallNs();
+        uint64_t startCycles = cycles();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+            uint32_t n = i % SAMPLES;
+            sink = filter.update(AttitudeFilter::accelPitch(ax[n], ay[n], az[n]), AttitudeFilter::gyroRate(gy[n], 65.5f), 0.001f);
+        }
+        printCost(names[t], startNs, startCycles, ITERATIONS);
+    }
+    (void)sink;
+}
+
+// dmpGetPitch() against the float quaternion/gravity/ypr chain, accuracy and cost
+static void benchPitchExtraction()
+{
+    MPU6050 mpu;
+    const uint16_t PACKETS = 1024;
+    static uint8_t packets[PACKETS][MPU6050_DMP_QUATERNION_SIZE];
+    Quaternion q;
+    VectorFloat gravity;
+    float ypr[3];
+
+    // Sweep pitch, roll and yaw; pitch up to +-89 deg, where atan2 is hardest
+    float worst = 0;
+    float worstAt = 0;
+    uint32_t checked = 0;
+    uint16_t stored = 0;
+    for (float pitch = -89; pitch <= 89; pitch += 0.25f)
+        for (float roll = -40; roll <= 40; roll += 10)
+            for (float yaw = 0; yaw < 360; yaw += 45)
+            {
+                // yaw about Z, then pitch about Y (negative: see dmpGetYawPitchRoll()), then roll about X
+                float cy = cosf(yaw * M_PI / 360), sy = sinf(yaw * M_PI / 360);
+                float cp = cosf(-pitch * M_PI / 360), sp = sinf(-pitch * M_PI / 360);
+                float cr = cosf(roll * M_PI / 360), sr = sinf(roll * M_PI / 360);
+                uint8_t packet[MPU6050_DMP_QUATERNION_SIZE];
+                encodeQuaternion(packet, cr * cp * cy + sr * sp * sy, sr * cp * cy - cr * sp * sy,
+                                 cr * sp * cy + sr * cp * sy, cr * cp * sy - sr * sp * cy);
+
+                float fast;
+                mpu.dmpGetPitch(&fast, packet);
+                mpu.dmpGetQuaternion(&q, packet);
+                mpu.dmpGetGravity(&gravity, &q);
+                mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
+                float error = fabsf(fast - ypr[1] * 180 / M_PI);
+                if (error > worst)
+                {
+                    worst = error;
+                    worstAt = pitch;
+                }
+                checked++;
+                if (stored < PACKETS && checked % 50 == 0) // spread over the whole sweep
+                    memcpy(packets[stored++], packet, sizeof(packet));
+            }
+    printf("dmpGetPitch vs dmpGetYawPitchRoll: %lu attitudes, worst difference %.5f deg (at pitch %.2f)\n",
+           (unsigned long)checked, worst, worstAt);
+
+    const uint32_t ITERATIONS = 2000000;
+    volatile float sink = 0;
+    uint64_t startNs = wallNs();
+    uint64_t startCycles = cycles();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+    {
+        const uint8_t *packet = packets[i % stored];
+        mpu.dmpGetQuaternion(&q, packet);
+        mpu.dmpGetGravity(&gravity, &q);
+        mpu.dmpGetYawPitchRoll(ypr, &q, &gravity);
+        sink = ypr[1] * 180 / M_PI;
+    }
+    printCost("dmp ypr", startNs, startCycles, ITERATIONS);
+
+    startNs = wallNs();
+    startCycles = cycles();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+    {
+        float pitch;
+        mpu.dmpGetPitch(&pitch, packets[i % stored]);
+        sink = pitch;
+    }
+    printCost("dmp pitch", startNs, startCycles, ITERATIONS);
+    (void)sink;
+}
+
+static void record(RunStats *stats, MPU6050Emulator &emu, uint64_t busBefore, float pitch)
+{
+    uint64_t now = emu.getTimeUs();
+    float error = fabsf(pitch - truePitch(now));
+    stats->samples++;
+    stats->busUs += emu.getBusTimeUs() - busBefore;
+    stats->ageUs += now - intTimeUs;
+    stats->errorSquares += error * error;
+    if (error > stats->worstError)
+        stats->worstError = error;
+}
+
+// Step the emulated clock, moving the sensor, until MPU_INT fires
+static void waitInterrupt(MPU6050Emulator &emu)
+{
+    for (uint32_t waited = 0; !intPending && waited < 20000; waited += 10)
+    {
+        emu.advance(10);
+        setMotion(emu, emu.getTimeUs());
+    }
+    intPending = false;
+}
+
+static bool runDmp(MPU6050Emulator &emu, uint32_t seconds, RunStats *stats)
+{
+    MPU6050 mpu;
+    if (quietDmpInitialize(mpu) != 0)
+        return false;
+    mpu.dmpSetFIFOLayout(0);
+    mpu.setDMPEnabled(true);
+    uint16_t packetSize = mpu.dmpGetFIFOPacketSize();
+
+    uint8_t fifoBuffer[64];
+    uint64_t end = emu.getTimeUs() + (uint64_t)seconds * 1000000;
+    while (emu.getTimeUs() < end)
+    {
+        waitInterrupt(emu);
+        uint64_t busBefore = emu.getBusTimeUs();
+        if (mpu.getFIFOCount() < packetSize)
+            continue;
+        if (mpu.dmpGetLatestFIFOPacket(fifoBuffer) != 0)
+            continue;
+        float pitch;
+        mpu.dmpGetPitch(&pitch, fifoBuffer);
+        record(stats, emu, busBefore, pitch);
+    }
+    return true;
+}
+
+// Same configuration as startRaw() in MotionControl.cpp
+static bool runRaw(MPU6050Emulator &emu, uint32_t seconds, AttitudeFilterType type, RunStats *stats)
+{
+    MPU6050 mpu;
+    mpu.initialize();
+    mpu.setClockSource(MPU6050_CLOCK_PLL_XGYRO);
+    mpu.setFullScaleGyroRange(MPU6050_GYRO_FS_500);
+    mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_4);
+    mpu.setDLPFMode(MPU6050_DLPF_BW_188);
+    mpu.setRate(0);
+    mpu.setIntEnabled(1 << MPU6050_INTERRUPT_DATA_RDY_BIT);
+    if (!mpu.testConnection())
+        return false;
+
+    AttitudeFilter filter(type);
+    uint64_t lastSample = emu.getTimeUs();
+    uint64_t end = lastSample + (uint64_t)seconds * 1000000;
+    // Let the filter settle on the gyro bias before scoring it
+    uint64_t scoreFrom = lastSample + 1000000;
+    while (emu.getTimeUs() < end + 1000000)
+    {
+        waitInterrupt(emu);
+        uint64_t busBefore = emu.getBusTimeUs();
+        int16_t ax, ay, az, gx, gy, gz;
+        mpu.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
+        uint64_t now = emu.getTimeUs();
+        float pitch = filter.update(AttitudeFilter::accelPitch(ax, ay, az), AttitudeFilter::gyroRate(gy, 65.5f), (now - lastSample) * 1e-6f);
+        lastSample = now;
+        if (now >= scoreFrom)
+            record(stats, emu, busBefore, pitch);
+    }
+    return true;
+}
+
+static int benchLatency(uint32_t clockHz, uint32_t seconds)
+{
+    const char *names[] = {"dmp 200 Hz", "raw complementary", "raw kalman"};
+    const float dlpfDelay[] = {DLPF_DELAY_BW_42_US, DLPF_DELAY_BW_188_US, DLPF_DELAY_BW_188_US};
+    for (uint8_t run = 0; run < 3; run++)
+    {
+        MPU6050Emulator emu;
+        emu.setClock(clockHz);
+        emu.setGyroBias(0, GYRO_BIAS_LSB, 0);
+        emu.setInterruptCallback(onInterrupt, &emu);
+        I2Cdev::setBus(&emu);
+        setMotion(emu, 0);
+
+        RunStats stats = {0, 0, 0, 0, 0};
+        bool ok = run == 0 ? runDmp(emu, seconds, &stats)
+                           : runRaw(emu, seconds, run == 1 ? FILTER_COMPLEMENTARY : FILTER_KALMAN, &stats);
+        if (!ok || stats.samples == 0)
+        {
+            printf("%s: no samples\n", names[run]);
+            return 1;
+        }
+        double age = (double)stats.ageUs / stats.samples;
+        printf("%-18s %7lu Hz: %6u samples  %6.1f us bus/sample  age %6.1f us  latency %6.1f us  rms error %5.2f deg  worst %5.2f deg\n",
+               names[run], (unsigned long)clockHz, stats.samples, (double)stats.busUs / stats.samples,
+               age, age + dlpfDelay[run], sqrt(stats.errorSquares / stats.samples), stats.worstError);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t clockHz = argc > 1 ? strtoul(argv[1], NULL, 0) : 400000;
+    uint32_t seconds = argc > 2 ? strtoul(argv[2], NULL, 0) : 5;
+
+    benchFilterCost();
+    benchPitchExtraction();
+    return benchLatency(clockHz, seconds);
+}
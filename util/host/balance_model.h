@@ -0,0 +1,142 @@
+// Wheeled inverted pendulum model of the robot, shared by the host
+// simulations (cascade_sim, lqr_design), with the firmware settings they
+// mirror. Two geared DC motors behind an L298N (torque falls linearly from
+// stall to the no-load speed, both scaled by battery voltage), gearbox
+// friction and floor rolling resistance. The physical numbers are estimates
+// for the TT-motor chassis, not measurements; rerun the tools with better
+// ones when they exist.
+
+#ifndef BALANCE_MODEL_H
+#define BALANCE_MODEL_H
+
+#include <math.h>
+#include <stdint.h>
+
+// Firmware settings (MotionControl.cpp / Shared.h)
+static const float KP = 25.0, KI = 80.0, KD = 1.2;
+static const float PID_D_FILTER = 0.005;
+static const float BALANCE_SETPOINT = 190; // input when upright; the IMU sits pitched 10 deg
+static const float CONTROL_DT = 0.005;     // 200 Hz DMP rate
+static const float MOVE_TILT = 4.0;        // FORWARD/REVERSE moveOffset
+static const float DRIVE_SPEED = 0.3;
+static const float SPEED_KP = 20.0, SPEED_KI = 20.0;
+static const float SPEED_FEEDFORWARD = 4.0;
+static const float SPEED_MAX_TILT = 8.0;
+static const float SPEED_LOOP_RATE = 50;
+static const float SPEED_ACCEL_LIMIT = 0.5;
+static const float MOTOR_NO_LOAD_SPEED = 0.8;
+static const float SPEED_ESTIMATE_TIME = 1.0;
+static const float MOTOR_LEAN_LOAD = 9.0;
+static const float IMU_HEIGHT = 0.1;
+static const float ACCEL_LSB_PER_G = 8192; // DMP FIFO and raw mode at +-4 g
+
+// Plant
+static const float G = 9.81;
+static const float BODY_MASS = 0.45;         // kg, with batteries
+static const float BODY_COM = 0.07;          // m, axle to centre of mass
+static const float BODY_INERTIA = 0.0012;    // kg m^2 about the centre of mass
+static const float WHEEL_MASS = 0.06;        // kg, both
+static const float WHEEL_RADIUS = 0.033;     // m
+static const float WHEEL_INERTIA = 0.5 * WHEEL_MASS * WHEEL_RADIUS * WHEEL_RADIUS;
+static const float STALL_TORQUE = 0.2;       // N m at the axle, both motors, full battery
+static const float GEARBOX_FRICTION = 0.006; // N m at the axle, both gearboxes
+static const float ACCEL_NOISE = 0.02;       // g, peak
+static const float PHYSICS_DT = 0.0002;
+static const float RAD_TO_DEG = 57.29578f;
+
+struct Floor
+{
+    const char *name;
+    float coulomb; // Rolling resistance, N m at the axle
+    float viscous; // N m per rad/s of wheel speed
+};
+
+struct Battery
+{
+    const char *name;
+    float voltage; // Relative to full charge
+};
+
+class Robot
+{
+public:
+    Robot(const Floor &floor, const Battery &battery)
+        : floor(floor), battery(battery), x(0), v(0), theta(0), omega(0), accel(0), alpha(0), push(0), noise(12345)
+    {
+    }
+
+    // drive: -255..255 as sent to setMotorSpeed()
+    void step(float drive, float dt)
+    {
+        float wheelRelative = v / WHEEL_RADIUS - omega; // Wheel speed against the body
+        float noLoad = MOTOR_NO_LOAD_SPEED / WHEEL_RADIUS;
+        float torque = STALL_TORQUE * battery.voltage * (drive / 255 - wheelRelative / (noLoad * battery.voltage));
+        torque -= friction(GEARBOX_FRICTION, wheelRelative, torque);
+
+        // The floor resists the wheels' roll, not their turn against the body
+        float wheel = v / WHEEL_RADIUS;
+        float roll = floor.viscous * wheel + friction(floor.coulomb, wheel, torque);
+
+        // Lagrange equations of the cart-pendulum: motor torque between wheel
+        // and body, rolling resistance between wheel and floor, push at the
+        // centre of mass
+        float c = cosf(theta), s = sinf(theta);
+        float a11 = BODY_MASS + WHEEL_MASS + WHEEL_INERTIA / (WHEEL_RADIUS * WHEEL_RADIUS);
+        float a12 = BODY_MASS * BODY_COM * c;
+        float a22 = BODY_INERTIA + BODY_MASS * BODY_COM * BODY_COM;
+        float b1 = (torque - roll) / WHEEL_RADIUS + BODY_MASS * BODY_COM * s * omega * omega + push;
+        float b2 = BODY_MASS * G * BODY_COM * s - torque + push * BODY_COM * c;
+        float det = a11 * a22 - a12 * a12;
+        accel = (b1 * a22 - a12 * b2) / det;
+        alpha = (a11 * b2 - a12 * b1) / det;
+
+        v += accel * dt;
+        omega += alpha * dt;
+        x += v * dt;
+        theta += omega * dt;
+    }
+
+    // Coulomb friction against the motion, or holding still against a smaller push
+    static float friction(float level, float speed, float push)
+    {
+        if (speed > 1e-3f)
+            return level;
+        if (speed < -1e-3f)
+            return -level;
+        return fabsf(push) < level ? push : (push > 0 ? level : -level);
+    }
+
+    // Firmware view: input = pitch + 180, rate = d(input)/dt
+    float input() { return BALANCE_SETPOINT - theta * RAD_TO_DEG; }
+    float rate() { return -omega * RAD_TO_DEG; }
+
+    // Accelerometer X/Z (LSB) of an IMU IMU_HEIGHT above the axle, X pointing
+    // forward and up by the pitch
+    void accelerometer(int16_t *ax, int16_t *az)
+    {
+        float c = cosf(theta), s = sinf(theta);
+        float forward = accel + IMU_HEIGHT * (alpha * c - omega * omega * s);
+        float up = -IMU_HEIGHT * (alpha * s + omega * omega * c) + G;
+        float pitch = (input() - 180) / RAD_TO_DEG;
+        float scale = ACCEL_LSB_PER_G / G;
+        *ax = (forward * cosf(pitch) + up * sinf(pitch)) * scale + random() * ACCEL_NOISE * ACCEL_LSB_PER_G;
+        *az = (-forward * sinf(pitch) + up * cosf(pitch)) * scale + random() * ACCEL_NOISE * ACCEL_LSB_PER_G;
+    }
+
+    const Floor &floor;
+    const Battery &battery;
+    float x, v, theta, omega;
+    float accel, alpha;
+    float push; // N, horizontal, forward positive
+
+private:
+    // -1..1, repeatable between runs
+    float random()
+    {
+        noise = noise * 1103515245 + 12345;
+        return ((noise >> 8) & 0xFFFF) / 32767.5f - 1;
+    }
+    uint32_t noise;
+};
+
+#endif
@@ -0,0 +1,153 @@
+// Host simulation of the drive control: open-loop tilt offsets (moveOffset,
+// SPEED_CONTROL 0) against the cascaded speed/angle controller
+// (SpeedController feeding the balance PidController, SPEED_CONTROL 1).
+//
+// The plant is the pendulum model in balance_model.h. The balance loop runs
+// at the DMP rate on a one-sample-old pitch, pitch rate and accelerometer
+// reading (with noise), with the firmware's gains, output deadband and
+// limits; the speed loop runs at its own rate on the WheelSpeedEstimator,
+// wired exactly as in TaskPID. The cascade runs with the battery voltage
+// as BATTERY_PIN would read it, and again without ("no sense"), where the
+// estimator assumes a full charge and on a low battery holds a speed short
+// by about the voltage drop.
+//
+// Each run drives forward for 5 s (FORWARD), then stops (STOP) for 3 s,
+// on a fresh battery and a low one, on a smooth floor and carpet. It reports
+// the speed over the last second of FORWARD, the time to get within 10% of
+// the target, overshoot, the largest lean and the distance rolled after
+// STOP. Exits non-zero if the cascade with the battery read falls over,
+// misses its target by more than 10%, or rolls more than STOP_LIMIT after
+// STOP.
+//
+// Usage: cascade_sim
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "PidController.h"
+#include "SpeedController.h"
+#include "balance_model.h"
+
+static const float STOP_LIMIT = 0.15; // m
+
+struct Result
+{
+    bool fell;
+    float speed;      // Mean over the last second of FORWARD
+    float riseTime;   // To within 10% of the target, -1 = never
+    float overshoot;  // Over the target, fraction
+    float maxTilt;    // deg from upright
+    float stopTravel; // m rolled after STOP
+};
+
+// FORWARD for 5 s then STOP for 3 s; cascade = SPEED_CONTROL 1, senseSupply = BATTERY_PIN
+static Result drive(const Floor &floor, const Battery &battery, bool cascade, bool senseSupply)
+{
+    Robot robot(floor, battery);
+    PidController pid(KP, KI, KD);
+    pid.setOutputLimits(-255, 255);
+    pid.setDerivativeFilter(PID_D_FILTER);
+    SpeedController speedLoop(SPEED_KP, SPEED_KI, SPEED_MAX_TILT, SPEED_LOOP_RATE);
+    speedLoop.setAccelerationLimit(SPEED_ACCEL_LIMIT);
+    speedLoop.setFeedforward(SPEED_FEEDFORWARD);
+    WheelSpeedEstimator estimator(MOTOR_NO_LOAD_SPEED, SPEED_ESTIMATE_TIME, MOTOR_LEAN_LOAD, IMU_HEIGHT);
+    if (senseSupply)
+        estimator.setSupply(battery.voltage);
+
+    Result result = {false, 0, -1, 0, 0, 0};
+    float sensedInput = robot.input(), sensedRate = robot.rate();
+    int16_t ax, az;
+    robot.accelerometer(&ax, &az);
+    float drive = 0, speedSum = 0, peak = 0, stopStart = 0;
+    uint32_t speedSamples = 0;
+    const uint32_t steps = 8.0f / CONTROL_DT;
+    for (uint32_t i = 0; i < steps; i++)
+    {
+        float t = i * CONTROL_DT;
+        bool forward = t < 5;
+        float moveOffset = forward ? -MOVE_TILT : 0;
+
+        // Same arithmetic as TaskPID
+        float offset = moveOffset;
+        if (cascade)
+        {
+            float lean = BALANCE_SETPOINT - sensedInput;
+            float forwardAccel = WheelSpeedEstimator::forwardAccel(ax, az, ACCEL_LSB_PER_G, sensedInput - 180);
+            estimator.update(drive, lean, -sensedRate, forwardAccel, CONTROL_DT);
+            offset = speedLoop.update(-moveOffset * (DRIVE_SPEED / MOVE_TILT), estimator.getSpeed(), CONTROL_DT);
+        }
+        float output = pid.update(BALANCE_SETPOINT + offset, sensedInput, sensedRate, CONTROL_DT);
+        drive = fabsf(output) < 10 ? 0 : output;
+
+        // DMP latency: the controller sees the previous sample
+        sensedInput = robot.input();
+        sensedRate = robot.rate();
+        robot.accelerometer(&ax, &az);
+        for (float s = 0; s < CONTROL_DT - PHYSICS_DT / 2; s += PHYSICS_DT)
+            robot.step(drive, PHYSICS_DT);
+
+        float tilt = fabsf(robot.theta) * RAD_TO_DEG;
+        if (tilt > result.maxTilt)
+            result.maxTilt = tilt;
+        if (tilt > 45)
+        {
+            result.fell = true;
+            return result;
+        }
+        if (forward)
+        {
+            if (robot.v > peak)
+                peak = robot.v;
+            if (result.riseTime < 0 && fabsf(robot.v - DRIVE_SPEED) < 0.1f * DRIVE_SPEED)
+                result.riseTime = t;
+            if (t >= 4)
+            {
+                speedSum += robot.v;
+                speedSamples++;
+            }
+            stopStart = robot.x;
+        }
+    }
+    result.speed = speedSum / speedSamples;
+    result.overshoot = peak > DRIVE_SPEED ? (peak - DRIVE_SPEED) / DRIVE_SPEED : 0;
+    result.stopTravel = robot.x - stopStart;
+    return result;
+}
+
+static void printResult(const char *mode, const Result &r)
+{
+    if (r.fell)
+    {
+        printf("  %-10s fell over (max lean %.1f deg)\n", mode, r.maxTilt);
+        return;
+    }
+    printf("  %-10s speed %5.2f m/s  rise %s%4.2f s  overshoot %3.0f%%  max lean %4.1f deg  rolled %5.2f m after STOP\n",
+           mode, r.speed, r.riseTime < 0 ? ">" : " ", r.riseTime < 0 ? 5.0f : r.riseTime, r.overshoot * 100,
+           r.maxTilt, r.stopTravel);
+}
+
+int main()
+{
+    const Floor floors[] = {{"smooth floor", 0.003f, 0.002f}, {"carpet", 0.006f, 0.003f}};
+    const Battery batteries[] = {{"full battery", 1.0f}, {"low battery", 0.8f}};
+
+    printf("Target %.2f m/s; open loop leans %.1f deg\n", DRIVE_SPEED, MOVE_TILT);
+    bool ok = true;
+    for (const Floor &floor : floors)
+    {
+        for (const Battery &battery : batteries)
+        {
+            printf("%s, %s\n", floor.name, battery.name);
+            printResult("open loop", drive(floor, battery, false, false));
+            printResult("no sense", drive(floor, battery, true, false));
+            Result cascade = drive(floor, battery, true, true);
+            printResult("cascade", cascade);
+            if (cascade.fell || fabsf(cascade.speed - DRIVE_SPEED) > 0.1f * DRIVE_SPEED ||
+                cascade.stopTravel > STOP_LIMIT)
+                ok = false;
+        }
+    }
+    if (!ok)
+        printf("FAIL: the cascade fell, missed its target or rolled too far after STOP\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+// LQR gain design for the balance controller (main/LqrController.h), from
+// the physical parameters in balance_model.h.
+//
+// Linearizes the pendulum about upright (full battery, no Coulomb friction),
+// on the state [lean (rad), lean rate (rad/s), wheel position (m), wheel
+// speed (m/s)] with motor drive (-1..1) as the input. It discretizes that
+// at the DMP rate and iterates the discrete Riccati equation to a fixed
+// point. The weights follow Bryson's rule: each state is weighted by one over
+// the square of its largest acceptable excursion, and the input by one over
+// full drive squared.
+//
+// It prints the gains in firmware units (PWM per deg, deg/s, m, m/s) as an
+// LQR_GAINS line, with the drive feedforward per m/s.
+// Then it checks them against the PID path (the balance PID with the speed
+// loop, SPEED_CONTROL 1) on the nonlinear model, with the same sensor delay,
+// noise, speed estimator and output deadband as TaskPID:
+// - push: a 3 N shove at the centre of mass for 0.1 s while standing. It
+//   reports the largest lean, how far the robot rolls, where it ends up and
+//   how long until it is back upright and still (lean under 2 deg, speed
+//   under 0.05 m/s). The PID path only holds speed, so it stops where the
+//   push left it; the LQR also holds position and rolls back;
+// - drive: FORWARD for 5 s, then STOP. It reports the speed over the last
+//   second and how long after STOP until the robot is still.
+// Exits non-zero if the LQR falls over in any run. It also says whether the
+// LQR settles at least as fast as the PID path everywhere; the PID stays the
+// default controller until it does, on this model and on the robot.
+//
+// Usage: lqr_design [max lean deg] [max rate deg/s] [max position m] [max speed m/s]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "LqrController.h"
+#include "PidController.h"
+#include "SpeedController.h"
+#include "balance_model.h"
+
+static const float PUSH_FORCE = 3.0;    // N
+static const float PUSH_TIME = 0.1;     // s
+static const float SETTLE_LEAN = 2.0;   // deg; friction can hold the robot still a degree or so off
+static const float SETTLE_SPEED = 0.05; // m/s
+
+typedef double Matrix[4][4];
+typedef double Vector[4];
+
+static void multiply(const Matrix a, const Matrix b, Matrix out)
+{
+    Matrix r;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+        {
+            r[i][j] = 0;
+            for (int k = 0; k < 4; k++)
+                r[i][j] += a[i][k] * b[k][j];
+        }
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[i][j] = r[i][j];
+}
+
+static void transpose(const Matrix a, Matrix out)
+{
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            out[j][i] = a[i][j];
+}
+
+// Body and wheel accelerations of the linearized model (theta, omega small)
+static void linearAccel(double theta, double omega, double v, double u, double *accel, double *alpha)
+{
+    double b = STALL_TORQUE * WHEEL_RADIUS / MOTOR_NO_LOAD_SPEED; // Back-EMF, N m per rad/s
+    double torque = STALL_TORQUE * u - b * (v / WHEEL_RADIUS - omega);
+    double roll = 0.002 * v / WHEEL_RADIUS; // Smooth floor, viscous part
+    double a11 = BODY_MASS + WHEEL_MASS + WHEEL_INERTIA / (WHEEL_RADIUS * WHEEL_RADIUS);
+    double a12 = BODY_MASS * BODY_COM;
+    double a22 = BODY_INERTIA + BODY_MASS * BODY_COM * BODY_COM;
+    double b1 = (torque - roll) / WHEEL_RADIUS;
+    double b2 = BODY_MASS * G * BODY_COM * theta - torque;
+    double det = a11 * a22 - a12 * a12;
+    *accel = (b1 * a22 - a12 * b2) / det;
+    *alpha = (a11 * b2 - a12 * b1) / det;
+}
+
+// Continuous model on [theta, omega, x, v]; the model is linear, so unit
+// inputs give the columns
+static void continuousModel(Matrix a, Vector b)
+{
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            a[i][j] = 0;
+    a[0][1] = 1;
+    a[2][3] = 1;
+    double accel, alpha;
+    for (int j = 0; j < 4; j++)
+    {
+        if (j == 2)
+            continue; // Position does not enter the dynamics
+        linearAccel(j == 0, j == 1, j == 3, 0, &accel, &alpha);
+        a[1][j] = alpha;
+        a[3][j] = accel;
+    }
+    linearAccel(0, 0, 0, 1, &accel, &alpha);
+    b[0] = 0;
+    b[1] = alpha;
+    b[2] = 0;
+    b[3] = accel;
+}
+
+// Zero-order hold: ad = e^(A dt), bd = integral of e^(A s) B ds, by series
+static void discretize(const Matrix a, const Vector b, double dt, Matrix ad, Vector bd)
+{
+    Matrix term, integral;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+        {
+            term[i][j] = i == j;
+            ad[i][j] = i == j;
+            integral[i][j] = (i == j) * dt;
+        }
+    for (int k = 1; k < 20; k++)
+    {
+        multiply(term, a, term);
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+            {
+                term[i][j] *= dt / k;
+                ad[i][j] += term[i][j];
+                integral[i][j] += term[i][j] * dt / (k + 1);
+            }
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        bd[i] = 0;
+        for (int j = 0; j < 4; j++)
+            bd[i] += integral[i][j] * b[j];
+    }
+}
+
+// Iterate P = Q + A'PA - A'PB (R + B'PB)^-1 B'PA; false if it does not settle
+static bool solveLqr(const Matrix a, const Vector b, const Vector q, double r, Vector k)
+{
+    Matrix p, at;
+    transpose(a, at);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            p[i][j] = (i == j) * q[i];
+
+    for (int iteration = 0; iteration < 200000; iteration++)
+    {
+        // pb = P B, bpb = B'PB, bpa = B'PA
+        Vector pb, bpa;
+        double bpb = r;
+        for (int i = 0; i < 4; i++)
+        {
+            pb[i] = 0;
+            for (int j = 0; j < 4; j++)
+                pb[i] += p[i][j] * b[j];
+            bpb += b[i] * pb[i];
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            bpa[j] = 0;
+            for (int i = 0; i < 4; i++)
+                bpa[j] += pb[i] * a[i][j];
+        }
+
+        Matrix pa, next;
+        multiply(p, a, pa);
+        multiply(at, pa, next);
+        double change = 0, size = 0;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                next[i][j] += (i == j) * q[i] - bpa[i] * bpa[j] / bpb;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+            {
+                // Keep P symmetric, or rounding drifts it away from the fixed point
+                double value = (next[i][j] + next[j][i]) / 2;
+                change = fmax(change, fabs(value - p[i][j]));
+                size = fmax(size, fabs(value));
+                p[i][j] = value;
+            }
+        for (int j = 0; j < 4; j++)
+            k[j] = bpa[j] / bpb;
+        if (change <= 1e-12 * size)
+            return true;
+    }
+    return false;
+}
+
+// Largest closed-loop eigenvalue magnitude, from the growth of (A - BK)^1024
+static double spectralRadius(const Matrix a, const Vector b, const Vector k)
+{
+    Matrix m;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            m[i][j] = a[i][j] - b[i] * k[j];
+    double scale = 0; // log of the factor divided out so far
+    for (int s = 0; s < 10; s++)
+    {
+        multiply(m, m, m);
+        scale *= 2;
+        double norm = 0;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                norm = fmax(norm, fabs(m[i][j]));
+        if (norm == 0)
+            return 0;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                m[i][j] /= norm;
+        scale += log(norm);
+    }
+    return exp(scale / 1024);
+}
+
+struct Result
+{
+    bool fell;
+    float maxLean;   // deg
+    float travel;    // m, furthest from the start (push) or speed over the last second of FORWARD (drive)
+    float offset;    // m from the start at the end (push)
+    float settle;    // s after the push or STOP until upright and still, -1 = never
+};
+
+enum Scenario
+{
+    SCENARIO_PUSH,
+    SCENARIO_DRIVE
+};
+
+static Result simulate(const Floor &floor, const Battery &battery, bool lqr, Scenario scenario, const float gains[4],
+                       float feedforward)
+{
+    Robot robot(floor, battery);
+    PidController pid(KP, KI, KD);
+    pid.setOutputLimits(-255, 255);
+    pid.setDerivativeFilter(PID_D_FILTER);
+    SpeedController speedLoop(SPEED_KP, SPEED_KI, SPEED_MAX_TILT, SPEED_LOOP_RATE);
+    speedLoop.setAccelerationLimit(SPEED_ACCEL_LIMIT);
+    speedLoop.setFeedforward(SPEED_FEEDFORWARD);
+    LqrController lqrController(gains);
+    lqrController.setAccelerationLimit(SPEED_ACCEL_LIMIT);
+    lqrController.setFeedforward(feedforward);
+    WheelSpeedEstimator estimator(MOTOR_NO_LOAD_SPEED, SPEED_ESTIMATE_TIME, MOTOR_LEAN_LOAD, IMU_HEIGHT);
+
+    const float duration = scenario == SCENARIO_PUSH ? 4 : 8;
+    const float disturbance = scenario == SCENARIO_PUSH ? 0.5f : 5; // Push, or STOP
+    Result result = {false, 0, 0, 0, -1};
+    float sensedInput = robot.input(), sensedRate = robot.rate();
+    int16_t ax, az;
+    robot.accelerometer(&ax, &az);
+    float drive = 0, speedSum = 0;
+    uint32_t speedSamples = 0;
+    const uint32_t steps = duration / CONTROL_DT;
+    for (uint32_t i = 0; i < steps; i++)
+    {
+        float t = i * CONTROL_DT;
+        float moveOffset = scenario == SCENARIO_DRIVE && t < disturbance ? -MOVE_TILT : 0;
+        robot.push = scenario == SCENARIO_PUSH && t >= disturbance && t < disturbance + PUSH_TIME ? PUSH_FORCE : 0;
+
+        // Same arithmetic as TaskPID
+        float lean = BALANCE_SETPOINT - sensedInput;
+        float forwardAccel = WheelSpeedEstimator::forwardAccel(ax, az, ACCEL_LSB_PER_G, sensedInput - 180);
+        estimator.update(drive, lean, -sensedRate, forwardAccel, CONTROL_DT);
+        float targetSpeed = -moveOffset * (DRIVE_SPEED / MOVE_TILT);
+        float output;
+        if (lqr)
+        {
+            output = lqrController.update(lean, -sensedRate, targetSpeed, estimator.getSpeed(), CONTROL_DT);
+        }
+        else
+        {
+            float offset = speedLoop.update(targetSpeed, estimator.getSpeed(), CONTROL_DT);
+            output = pid.update(BALANCE_SETPOINT + offset, sensedInput, sensedRate, CONTROL_DT);
+        }
+        drive = fabsf(output) < 10 ? 0 : output;
+
+        // DMP latency: the controller sees the previous sample
+        sensedInput = robot.input();
+        sensedRate = robot.rate();
+        robot.accelerometer(&ax, &az);
+        for (float s = 0; s < CONTROL_DT - PHYSICS_DT / 2; s += PHYSICS_DT)
+            robot.step(drive, PHYSICS_DT);
+
+        float tilt = fabsf(robot.theta) * RAD_TO_DEG;
+        if (tilt > result.maxLean)
+            result.maxLean = tilt;
+        if (tilt > 45)
+        {
+            result.fell = true;
+            return result;
+        }
+        if (scenario == SCENARIO_PUSH && fabsf(robot.x) > result.travel)
+            result.travel = fabsf(robot.x);
+        if (scenario == SCENARIO_DRIVE && t >= disturbance - 1 && t < disturbance)
+        {
+            speedSum += robot.v;
+            speedSamples++;
+        }
+
+        // Settled once it stays upright and still to the end
+        bool still = tilt < SETTLE_LEAN && fabsf(robot.v) < SETTLE_SPEED;
+        if (t < disturbance || !still)
+            result.settle = -1;
+        else if (result.settle < 0)
+            result.settle = t - disturbance;
+    }
+    if (scenario == SCENARIO_DRIVE)
+        result.travel = speedSum / speedSamples;
+    result.offset = robot.x;
+    return result;
+}
+
+static void printResult(const char *mode, Scenario scenario, const Result &r)
+{
+    if (r.fell)
+    {
+        printf("  %-4s fell over (max lean %.1f deg)\n", mode, r.maxLean);
+        return;
+    }
+    char settle[16];
+    if (r.settle < 0)
+        snprintf(settle, sizeof(settle), "never");
+    else
+        snprintf(settle, sizeof(settle), "%.2f s", r.settle);
+    if (scenario == SCENARIO_PUSH)
+        printf("  %-4s max lean %4.1f deg  rolled %4.2f m, ends %5.2f m from the start  settled in %s\n", mode,
+               r.maxLean, r.travel, r.offset, settle);
+    else
+        printf("  %-4s speed %4.2f m/s  max lean %4.1f deg  still %s after STOP\n", mode, r.travel, r.maxLean, settle);
+}
+
+int main(int argc, char **argv)
+{
+    // Largest acceptable excursion of each state, and of the drive (full PWM)
+    float maxLean = argc > 1 ? atof(argv[1]) : 2.0f;  // deg
+    float maxRate = argc > 2 ? atof(argv[2]) : 40.0f; // deg/s
+    float maxPosition = argc > 3 ? atof(argv[3]) : 0.1f;
+    float maxSpeed = argc > 4 ? atof(argv[4]) : 0.3f;
+
+    Matrix a, ad;
+    Vector b, bd, k;
+    continuousModel(a, b);
+    discretize(a, b, CONTROL_DT, ad, bd);
+    const Vector q = {1 / pow(maxLean / RAD_TO_DEG, 2), 1 / pow(maxRate / RAD_TO_DEG, 2), 1 / pow(maxPosition, 2),
+                      1 / pow(maxSpeed, 2)};
+    if (!solveLqr(ad, bd, q, 1.0, k))
+    {
+        printf("Riccati iteration did not converge\n");
+        return 1;
+    }
+
+    // u = -K x in drive fraction per SI unit; the firmware works in PWM and degrees
+    float gains[4] = {(float)(255 * k[0] / RAD_TO_DEG), (float)(255 * k[1] / RAD_TO_DEG), (float)(255 * k[2]),
+                      (float)(255 * k[3])};
+    double backEmf = STALL_TORQUE * WHEEL_RADIUS / MOTOR_NO_LOAD_SPEED;
+    float feedforward = 255 * (backEmf + 0.002) / (WHEEL_RADIUS * STALL_TORQUE);
+
+    printf("Weights: lean %.1f deg, rate %.0f deg/s, position %.2f m, speed %.2f m/s, full drive\n", maxLean, maxRate,
+           maxPosition, maxSpeed);
+    printf("Closed-loop spectral radius %.4f at %.0f Hz\n", spectralRadius(ad, bd, k), 1 / CONTROL_DT);
+    printf("const float LQR_GAINS[4] = {%.2f, %.3f, %.1f, %.1f}; // PWM per deg, deg/s, m, m/s\n", gains[0], gains[1],
+           gains[2], gains[3]);
+    printf("const float LQR_FEEDFORWARD = %.0f; // PWM per m/s\n", feedforward);
+
+    const Floor floors[] = {{"smooth floor", 0.003f, 0.002f}, {"carpet", 0.006f, 0.003f}};
+    const Battery battery = {"full battery", 1.0f};
+    bool ok = true, faster = true;
+    for (const Floor &floor : floors)
+    {
+        for (int s = 0; s < 2; s++)
+        {
+            Scenario scenario = s == 0 ? SCENARIO_PUSH : SCENARIO_DRIVE;
+            if (scenario == SCENARIO_PUSH)
+                printf("%s, push %.0f N for %.1f s\n", floor.name, PUSH_FORCE, PUSH_TIME);
+            else
+                printf("%s, FORWARD %.2f m/s then STOP\n", floor.name, DRIVE_SPEED);
+            Result pid = simulate(floor, battery, false, scenario, gains, feedforward);
+            Result lqr = simulate(floor, battery, true, scenario, gains, feedforward);
+            printResult("PID", scenario, pid);
+            printResult("LQR", scenario, lqr);
+            ok = ok && !lqr.fell;
+            if (lqr.fell || lqr.settle < 0 || (pid.settle >= 0 && lqr.settle > pid.settle))
+                faster = false;
+        }
+    }
+    printf(faster ? "LQR settles at least as fast as the PID path\n" : "LQR settles slower than the PID path\n");
+    if (!ok)
+        printf("FAIL: the LQR fell over\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+// Host benchmark for the MPU6050 DMP read path.
+// Runs dmpInitialize() and the TaskPID FIFO drain (INT_STATUS, FIFO count,
+// one 42-byte packet per DMP interrupt) against the emulated MPU6050 and
+// reports bus time per loop with register reads issued as one repeated-start
+// transaction versus a pointer write followed by a separate read.
+//
+// An interrupt-driven run sleeps until the emulated MPU_INT fires, like
+// TaskPID, instead of polling every millisecond, first with the full 42-byte
+// DMP packet and then with the quaternion + gyro layout TaskPID uses. Each run
+// reports the latency from the DMP interrupt to the packet being read.
+//
+// A stalled run holds the interrupt-driven loop off for 35 ms every 100 ms
+// (and once long enough to overflow the FIFO), and reports how many packets
+// the burst drain skipped to stay on the newest one.
+//
+// Before that it times a 42-byte FIFO read at 100 kHz, 400 kHz and 1 MHz, and
+// it times a cold DMP start against a warm one (firmware still
+// resident). A final emulated run injects bus timeouts and reports the worst-case loop
+// time, which the per-transaction deadline must keep bounded.
+//
+// Built with I2CDEV_TRACE, it also prints the per-register transaction trace
+// of the repeated-start loop.
+//
+// Given an i2c-dev path it runs the same loop on a real MPU6050 and reports
+// wall-clock time instead.
+//
+// Usage: mpu6050_bench [/dev/i2c-N] [clock_hz] [overhead_us] [seconds]
+// overhead_us is the emulated per-transaction driver cost (default 0).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "I2Cdev.h"
+#include "I2CdevBus.h"
+#include "MPU6050_6Axis_MotionApps20.h"
+#include "MPU6050_Emulator.h"
+
+struct LoopStats
+{
+    uint32_t loops;
+    uint32_t packets;
+    uint64_t busUs;
+    uint32_t transactions;
+    uint64_t worstLoopUs;
+    uint64_t latencyUs;
+    uint32_t skipped;
+};
+
+// Bus time source for the worst-case loop time (the emulator's clock, or wall time)
+static MPU6050Emulator *clockSource = NULL;
+
+static uint64_t nowUs();
+
+// Set by the emulated MPU_INT line
+static volatile bool intPending = false;
+static uint64_t intTimeUs = 0;
+
+static void onInterrupt(void *arg)
+{
+    intPending = true;
+    intTimeUs = ((MPU6050Emulator *)arg)->getTimeUs();
+}
+
+static uint64_t wallUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// dmpInitialize() logs every step; keep it out of the report
+static uint8_t quietDmpInitialize(MPU6050 &mpu, bool resume = false)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        return resume ? mpu.dmpResume() : mpu.dmpInitialize();
+    uint8_t status = resume ? mpu.dmpResume() : mpu.dmpInitialize();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    return status;
+}
+
+static uint64_t nowUs()
+{
+    return clockSource ? clockSource->getTimeUs() : wallUs();
+}
+
+// Same read sequence as TaskPID for durationUs. Interrupt-driven, each pass
+// first sleeps until MPU_INT fires (or 20 ms pass); otherwise passes are
+// paced with vTaskDelay(1).
+static void runLoop(MPU6050 &mpu, uint64_t durationUs, LoopStats *stats, bool interruptDriven = false)
+{
+    uint8_t fifoBuffer[64];
+    uint16_t packetSize = mpu.dmpGetFIFOPacketSize();
+    uint16_t fifoCount = 0;
+    uint64_t end = nowUs() + durationUs;
+    while (nowUs() < end)
+    {
+        if (interruptDriven && fifoCount < packetSize)
+        {
+            for (uint32_t waited = 0; !intPending && waited < 20000; waited += 10)
+                clockSource->advance(10);
+        }
+        // TaskPID learns of a packet from the interrupt; polling needs INT_STATUS
+        uint8_t intStatus = intPending ? 0x02 : 0;
+        intPending = false;
+
+        uint64_t start = nowUs();
+        uint32_t errorsBefore = I2Cdev::errors;
+        if (!interruptDriven)
+            intStatus = mpu.getIntStatus();
+        if (I2Cdev::errors == errorsBefore)
+            fifoCount = mpu.getFIFOCount();
+
+        if (I2Cdev::errors != errorsBefore)
+        {
+        }
+        else if ((intStatus & 0x12) || fifoCount >= packetSize)
+        {
+            for (uint8_t n = 0; fifoCount < packetSize && n < 10 && I2Cdev::errors == errorsBefore; n++)
+                fifoCount = mpu.getFIFOCount();
+            if (fifoCount > packetSize && I2Cdev::errors == errorsBefore)
+            {
+                uint16_t skipped = 0;
+                if (mpu.dmpGetLatestFIFOPacket(fifoBuffer, &skipped, fifoCount) == 0)
+                {
+                    stats->packets++;
+                    stats->latencyUs += nowUs() - intTimeUs;
+                }
+                stats->skipped += skipped;
+                fifoCount %= packetSize;
+            }
+            else if (fifoCount == packetSize && I2Cdev::errors == errorsBefore)
+            {
+                mpu.getFIFOBytes(fifoBuffer, packetSize);
+                fifoCount -= packetSize;
+                if (I2Cdev::errors == errorsBefore)
+                {
+                    stats->packets++;
+                    stats->latencyUs += nowUs() - intTimeUs;
+                }
+            }
+        }
+        stats->loops++;
+        uint64_t elapsed = nowUs() - start;
+        if (elapsed > stats->worstLoopUs)
+            stats->worstLoopUs = elapsed;
+        if (!interruptDriven)
+            vTaskDelay(1 / portTICK_PERIOD_MS);
+    }
+}
+
+// Cold start (MPU just powered, full upload) versus warm start (firmware resident)
+static void benchStartup(uint32_t clockHz, uint32_t overheadUs)
+{
+    MPU6050Emulator emu;
+    emu.setClock(clockHz);
+    emu.setTransactionOverhead(overheadUs);
+    I2Cdev::setBus(&emu);
+
+    MPU6050 mpu;
+    uint32_t start = emu.micros();
+    quietDmpInitialize(mpu, true);
+    uint32_t cold = emu.micros() - start;
+    uint32_t upload = mpu.dmpUploadTime;
+
+    start = emu.micros();
+    quietDmpInitialize(mpu, true);
+    uint32_t warm = emu.micros() - start;
+
+    printf("DMP start at %lu Hz: cold %lu us (firmware upload %lu us), warm %lu us\n",
+           (unsigned long)clockHz, (unsigned long)cold, (unsigned long)upload, (unsigned long)warm);
+}
+
+// One DMP packet read from FIFO_R_W at each clock I2Cdev accepts
+static void benchClocks(uint32_t overheadUs)
+{
+    const uint32_t clocks[] = {100000, 400000, 1000000};
+    MPU6050Emulator emu;
+    emu.setTransactionOverhead(overheadUs);
+    I2Cdev::setBus(&emu);
+    for (uint8_t i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++)
+    {
+        I2Cdev::setClock(clocks[i]);
+        uint32_t us = I2Cdev::benchmarkRead(MPU6050_DEFAULT_ADDRESS, MPU6050_RA_FIFO_R_W, 42, 100);
+        printf("FIFO packet read at %7lu Hz: %lu us\n", (unsigned long)clocks[i], (unsigned long)us);
+    }
+}
+
+#ifdef I2CDEV_TRACE
+static void printTrace()
+{
+    I2CdevTraceStats stats[I2CDEV_TRACE_SLOTS];
+    uint8_t n = I2Cdev::traceSnapshot(stats, I2CDEV_TRACE_SLOTS);
+    printf("  dev reg dir    count  errors     bytes   min us   avg us   max us  histogram (<2^b us)\n");
+    for (uint8_t i = 0; i < n; i++)
+    {
+        printf("  %02x  %02x  %c  %8lu %7lu %9lu %8lu %8lu %8lu ",
+               stats[i].devAddr, stats[i].regAddr, stats[i].write ? 'w' : 'r',
+               (unsigned long)stats[i].count, (unsigned long)stats[i].errors, (unsigned long)stats[i].bytes,
+               (unsigned long)stats[i].minUs, (unsigned long)(stats[i].totalUs / stats[i].count),
+               (unsigned long)stats[i].maxUs);
+        for (uint8_t b = 0; b < I2CDEV_TRACE_BUCKETS; b++)
+            if (stats[i].histogram[b])
+                printf(" %u:%lu", b, (unsigned long)stats[i].histogram[b]);
+        printf("\n");
+    }
+    if (I2Cdev::traceDropped)
+        printf("  %lu transactions not traced (all slots in use)\n", (unsigned long)I2Cdev::traceDropped);
+}
+#endif
+
+static int benchEmulator(uint32_t clockHz, uint32_t overheadUs, uint32_t seconds)
+{
+    benchClocks(overheadUs);
+    benchStartup(clockHz, overheadUs);
+
+    const char *modes[] = {"repeated-start", "split", "interrupt", "quat+gyro", "stalled", "with timeouts"};
+    for (int mode = 0; mode < 6; mode++)
+    {
+        MPU6050Emulator emu;
+        emu.setClock(clockHz);
+        emu.setTransactionOverhead(overheadUs);
+        emu.setSplitReads(mode == 1);
+        emu.setInterruptCallback(onInterrupt, &emu);
+        I2Cdev::setBus(&emu);
+        clockSource = &emu;
+
+        MPU6050 mpu;
+        if (quietDmpInitialize(mpu) != 0)
+        {
+            printf("dmpInitialize failed\n");
+            return 1;
+        }
+        if (mode >= 3)
+            mpu.dmpSetFIFOLayout(MPU6050_DMP_FIFO_GYRO);
+        mpu.setDMPEnabled(true);
+
+        emu.resetCounters();
+        I2Cdev::resetErrorCounters();
+#ifdef I2CDEV_TRACE
+        I2Cdev::traceReset();
+#endif
+        LoopStats stats = {0, 0, 0, 0, 0, 0, 0};
+        uint64_t start = emu.getTimeUs();
+        if (mode == 4)
+        {
+            // the control task held off by something else for a while
+            emu.advance(300000);
+            for (uint32_t n = 0; n < seconds * 10; n++)
+            {
+                runLoop(mpu, 65000, &stats, true);
+                emu.advance(35000);
+            }
+        }
+        else if (mode == 5)
+        {
+            // one stuck transaction every 100 ms
+            for (uint32_t n = 0; n < seconds * 10; n++)
+            {
+                runLoop(mpu, 100000, &stats);
+                emu.failNext(1, I2CDEV_ERR_TIMEOUT);
+            }
+        }
+        else
+        {
+            runLoop(mpu, (uint64_t)seconds * 1000000, &stats, mode == 2 || mode == 3);
+        }
+        stats.busUs = emu.getBusTimeUs();
+        stats.transactions = emu.getTransactionCount();
+
+        printf("%-15s %7lu Hz: %6u loops %6u packets  %7.1f us/loop  %6.2f txn/loop  %7.1f us/packet  bus %4.1f%%  worst %6lu us  latency %6.1f us  skipped %4u  errors %u\n",
+               modes[mode], (unsigned long)clockHz, stats.loops, stats.packets,
+               (double)stats.busUs / stats.loops, (double)stats.transactions / stats.loops,
+               stats.packets ? (double)stats.busUs / stats.packets : 0.0,
+               100.0 * stats.busUs / (emu.getTimeUs() - start), (unsigned long)stats.worstLoopUs,
+               stats.packets ? (double)stats.latencyUs / stats.packets : 0.0, stats.skipped,
+               (unsigned)I2Cdev::errors);
+#ifdef I2CDEV_TRACE
+        if (mode == 0)
+            printTrace();
+#endif
+    }
+    clockSource = NULL;
+    return 0;
+}
+
+static int benchDevice(const char *path, uint32_t seconds)
+{
+    I2CdevLinuxBus linuxBus;
+    if (!linuxBus.open(path))
+    {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+    I2Cdev::setBus(&linuxBus);
+
+    MPU6050 mpu;
+    if (!mpu.testConnection() || quietDmpInitialize(mpu) != 0)
+    {
+        printf("no MPU6050 with DMP on %s\n", path);
+        return 1;
+    }
+    mpu.setDMPEnabled(true);
+
+    LoopStats stats = {0, 0, 0, 0, 0, 0, 0};
+    uint64_t start = wallUs();
+    runLoop(mpu, (uint64_t)seconds * 1000000, &stats);
+    uint64_t elapsed = wallUs() - start;
+    printf("%s: %u loops %u packets  %.1f us/loop (incl. 1 ms delay)  worst %lu us  errors %u\n",
+           path, stats.loops, stats.packets, (double)elapsed / stats.loops,
+           (unsigned long)stats.worstLoopUs, (unsigned)I2Cdev::errors);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    int arg = 1;
+    if (arg < argc && argv[arg][0] == '/')
+        device = argv[arg++];
+    uint32_t clockHz = arg < argc ? strtoul(argv[arg++], NULL, 0) : 400000;
+    uint32_t overheadUs = arg < argc ? strtoul(argv[arg++], NULL, 0) : 0;
+    uint32_t seconds = arg < argc ? strtoul(argv[arg++], NULL, 0) : 2;
+
+    if (device)
+        return benchDevice(device, seconds);
+    return benchEmulator(clockHz, overheadUs, seconds);
+}
@@ -0,0 +1,160 @@
+// Host benchmark for PidController (main/PidController.cpp) against PID_v1.
+//
+// PID_v1 is an Arduino library and is not built here, so this carries a
+// double-precision copy of its Compute() arithmetic (proportional on error,
+// derivative on measurement, gains pre-scaled by the sample time, integral
+// and output clamped to the limits), without the millis() gate.
+//
+// It checks that both give the same output on an unsaturated run, times a
+// step of each (host time and TSC cycles; the host FPU does double as fast
+// as float, so the gap on the ESP32 is larger: build the firmware with
+// PID_BENCHMARK for target cycles), and compares how long each keeps
+// pushing the old way after a saturating error reverses, which is where
+// anti-windup shows.
+//
+// Usage: pid_bench
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "PidController.h"
+
+static const float KP = 25.0, KI = 80.0, KD = 1.2; // TaskPID gains
+static const float DT = 0.005;                     // 200 Hz DMP rate
+
+// PID_v1 Compute() arithmetic, DIRECT, proportional on error
+class PidV1Reference
+{
+public:
+    PidV1Reference(double kp, double ki, double kd, double sampleTime)
+        : kp(kp), ki(ki * sampleTime), kd(kd / sampleTime), outMin(-255), outMax(255), outputSum(0), lastInput(0), started(false)
+    {
+    }
+
+    double compute(double setpoint, double input)
+    {
+        if (!started)
+        {
+            started = true;
+            lastInput = input;
+        }
+        double error = setpoint - input;
+        double dInput = input - lastInput;
+        outputSum += ki * error;
+        if (outputSum > outMax)
+            outputSum = outMax;
+        else if (outputSum < outMin)
+            outputSum = outMin;
+        double output = kp * error + outputSum - kd * dInput;
+        if (output > outMax)
+            output = outMax;
+        else if (output < outMin)
+            output = outMin;
+        lastInput = input;
+        return output;
+    }
+
+private:
+    double kp, ki, kd;
+    double outMin, outMax;
+    double outputSum;
+    double lastInput;
+    bool started;
+};
+
+static uint64_t wallNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Time stamp counter where there is one, nanoseconds otherwise
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return wallNs();
+#endif
+}
+
+static void checkEquivalence()
+{
+    PidV1Reference reference(KP, KI, KD, DT);
+    PidController controller(KP, KI, KD);
+    double worst = 0;
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        float input = 190 + 0.5f * sinf(i * DT * 2 * M_PI) + 0.1f * sinf(i * 1.7f);
+        double a = reference.compute(190, input);
+        double b = controller.update(190, input, DT);
+        if (fabs(a - b) > worst)
+            worst = fabs(a - b);
+    }
+    printf("unsaturated run: worst output difference %.5f\n", worst);
+}
+
+static void benchCost()
+{
+    const uint32_t STEPS = 2000000;
+    static float inputs[1024];
+    for (uint32_t i = 0; i < 1024; i++)
+        inputs[i] = 190 + 5 * sinf(i * 0.05f);
+
+    volatile double sink = 0;
+    PidV1Reference reference(KP, KI, KD, DT);
+    uint64_t startNs = wallNs(), startCycles = cycles();
+    for (uint32_t i = 0; i < STEPS; i++)
+        sink = reference.compute(190, inputs[i & 1023]);
+    printf("%-22s %6.1f ns/step %6.1f cycles/step\n", "PID_v1 (double)", (double)(wallNs() - startNs) / STEPS,
+           (double)(cycles() - startCycles) / STEPS);
+
+    const char *names[] = {"PidController", "PidController + D LPF"};
+    for (uint8_t filtered = 0; filtered < 2; filtered++)
+    {
+        PidController controller(KP, KI, KD);
+        controller.setDerivativeFilter(filtered ? 0.005f : 0);
+        startNs = wallNs();
+        startCycles = cycles();
+        for (uint32_t i = 0; i < STEPS; i++)
+            sink = controller.update(190, inputs[i & 1023], DT);
+        printf("%-22s %6.1f ns/step %6.1f cycles/step\n", names[filtered], (double)(wallNs() - startNs) / STEPS,
+               (double)(cycles() - startCycles) / STEPS);
+    }
+    (void)sink;
+}
+
+// Hold a 15 deg error for 2 s (output saturated), then tilt through the
+// setpoint at 20 deg/s to a 2 deg error the other way, and time how long
+// each output keeps pushing the old way
+static void benchWindup()
+{
+    PidV1Reference reference(KP, KI, KD, DT);
+    PidController controller(KP, KI, KD);
+    int32_t referenceSteps = -1, controllerSteps = -1;
+    for (int32_t i = 0; i < 2000; i++)
+    {
+        float input = i < 400 ? 175 : fminf(192, 175 + (i - 400) * 0.1f);
+        double a = reference.compute(190, input);
+        double b = controller.update(190, input, DT);
+        if (i >= 400 && referenceSteps < 0 && a < 0)
+            referenceSteps = i - 400;
+        if (i >= 400 && controllerSteps < 0 && b < 0)
+            controllerSteps = i - 400;
+    }
+    printf("after the error reverses, output keeps the old sign for: PID_v1 %.0f ms, PidController %.0f ms\n",
+           referenceSteps * DT * 1000, controllerSteps * DT * 1000);
+}
+
+int main()
+{
+    checkEquivalence();
+    benchCost();
+    benchWindup();
+    return 0;
+}
@@ -1,6 +1,8 @@
 // Arduino sketch that returns calibration offsets for MPU6050
 //   Version 1.1  (31th January 2014)
 //   Version 1.2 (25th August 2019)
+//   Version 2.0: uses MPU6050::calibrateOffsets(), which finishes in a bounded
+//   number of passes (seconds) instead of looping until every axis is in a deadzone
 // Done by Luis Ródenas <luisrodenaslorda@gmail.com> and improved by Shakeel <blinkmaker.com>
 // Based on the I2Cdev library and previous work by Jeff Rowberg <jeff@rowberg.net>
 // Updates (of the library) should (hopefully) always be available at https://github.com/jrowberg/i2cdevlib
@@ -8,6 +10,8 @@
 // These offsets were meant to calibrate MPU6050's internal DMP, but can be also useful for reading sensors.
 // The effect of temperature has not been taken into account so I can't promise that it will work if you
 // calibrate indoors and then use it outdoors. Best is to calibrate and use at the same room temperature.
+// (The robot firmware's CALIBRATE command does: each run is stored with the die temperature, and
+// calibrations a few degrees apart give it a gyro bias model that it follows as the robot warms up.)
 
 /* ==========  LICENSE  ==================================
  I2Cdev device library code is placed under the MIT license
@@ -36,13 +40,14 @@
 // I2Cdev and MPU6050 must be installed as libraries
 #include "I2Cdev.h"
 #include "MPU6050.h"
-#include "Wire.h"
 
 ///////////////////////////////////   CONFIGURATION   /////////////////////////////
-// Change this 3 variables if you want to fine tune the skecth to your needs.
-int buffersize = 1000; // Amount of readings used to average, make it higher to get more precision but sketch will be slower  (default:1000)
-int acel_deadzone = 8; // Acelerometer error allowed, make it lower to get more precision, but sketch may not converge  (default:8)
-int gyro_deadzone = 1; // Gyro error allowed, make it lower to get more precision, but sketch may not converge  (default:1)
+// Change these if you want to fine tune the sketch to your needs.
+#define SDA_PIN 21
+#define SCL_PIN 22
+#define I2C_CLOCK 400000
+const uint16_t samples = MPU6050_CALIBRATION_SAMPLES; // Readings averaged per pass, higher = more precise but slower (default:250)
+const uint8_t maxPasses = 10;                          // Upper bound on passes; the whole run takes at most about maxPasses * (samples + 10) ms
 
 // default I2C address is 0x68
 // specific I2C addresses may be passed as a parameter here
@@ -51,23 +56,16 @@ int gyro_deadzone = 1; // Gyro error allowed, make it lower to get more precisio
 // MPU6050 accelgyro;
 MPU6050 accelgyro(0x68); // default <-- use for AD0 high
 
-int16_t ax, ay, az, gx, gy, gz;
-
-int mean_ax, mean_ay, mean_az, mean_gx, mean_gy, mean_gz, state = 0;
-int ax_offset, ay_offset, az_offset, gx_offset, gy_offset, gz_offset;
-
-int mpuConnection;
-
 ///////////////////////////////////   SETUP   ////////////////////////////////////
 void setup()
 {
-    // join I2C bus (I2Cdev library doesn't do this automatically)
-    Wire.begin();
-    Wire.setClock(400000); // 400kHz I2C clock
-
     // initialize serial communication
     Serial.begin(9600);
 
+    // join I2C bus and set the clock (I2Cdev::initialize() configures the ESP32 driver)
+    if (!I2Cdev::initialize(I2C_NUM_0, (gpio_num_t)SDA_PIN, (gpio_num_t)SCL_PIN, I2C_CLOCK))
+        Serial.println("I2C init failed");
+
     // initialize MPU-6050
     accelgyro.initialize();
 
@@ -77,7 +75,6 @@ void setup()
 
     Serial.println("Place the MPU-6050 breakout board in a flat or horizontal position, with SMD components facing up.\n");
     Serial.println(F("Type in any character and press Enter/Send to start MPU-6050 calibration..."));
-
     while (Serial.available() == 0)
     {
     } // wait for character to be entered
@@ -87,201 +84,83 @@ void setup()
     // start message
     Serial.println("\n--------------------------------------------------------------");
     Serial.println("\nStarting MPU-6050 Calibration Sketch.");
-    delay(1000);
     Serial.println("\nDon't touch the MPU-6050 until you see a \"FINISHED!\" message.");
-    delay(2000);
+    delay(1000);
 
-    // verify connection
-    // Serial.println(accelgyro.testConnection() ? "MPU-6050 connection SUCCESSFUL!" : "MPU-6050 connection FAILED.");
-    // delay(1000);
     Serial.println("\n--------------------------------------------------------------");
     Serial.println("\nVerifying MPU-6050 connection...");
-    delay(500);
-
-    mpuConnection = accelgyro.testConnection();
-
-    if (mpuConnection == 0)
+    if (!accelgyro.testConnection())
     {
         Serial.println("\nMPU-6050 connection FAILED.");
-        Serial.println("\nCheck your boards and connections. Reset the Arduino board to run the calibration sketch again.");
+        Serial.println("\nCheck your boards and connections. Reset the board to run the calibration sketch again.");
+        while (1)
+            ;
     }
-
-    while (mpuConnection == 0)
-    {
-    } // wait for MPU-6050 connection to be established.
-
     Serial.println("\nMPU-6050 connection SUCCESSFUL!");
-    delay(500);
     Serial.println("\n--------------------------------------------------------------");
-    Serial.println("\nResetting MPU-6050 offsets.");
-
-    // reset offsets
-    accelgyro.setXAccelOffset(0);
-    accelgyro.setYAccelOffset(0);
-    accelgyro.setZAccelOffset(0);
-    accelgyro.setXGyroOffset(0);
-    accelgyro.setYGyroOffset(0);
-    accelgyro.setZGyroOffset(0);
-
-    delay(500);
 }
 
-///////////////////////////////////   LOOP   ////////////////////////////////////
-void loop()
+// Progress after every pass: remaining bias per axis at the offsets tried
+void printPass(const MPU6050CalibrationProgress *progress, void *arg)
 {
-    if (state == 0)
-    {
-        Serial.println("\nReading accelerometer and gyroscope sensors for first time.");
-        meansensors();
-        state++;
-        delay(1000);
-    }
-
-    if (state == 1)
-    {
-        Serial.println("\nCalculating offsets");
-        calibration();
-        state++;
-        delay(1000);
-    }
-
-    if (state == 2)
-    {
-        meansensors();
-        Serial.println("\nFINISHED!");
-        Serial.println("\n==============================================================");
-        Serial.println("\nRESULTS:");
-        Serial.println("\nSensor data is listed in the format:\tacelX\tacelY\tacelZ\tgyroX\tgyroY\tgyroZ");
-        Serial.print("\nSensor readings INCLUDING offsets:\t");
-        Serial.print(mean_ax);
-        Serial.print("\t");
-        Serial.print(mean_ay);
-        Serial.print("\t");
-        Serial.print(mean_az);
-        Serial.print("\t");
-        Serial.print(mean_gx);
-        Serial.print("\t");
-        Serial.print(mean_gy);
-        Serial.print("\t");
-        Serial.println(mean_gz);
-
-        Serial.println("\nCompare with IDEAL sensor readings:\t0\t0\t16384\t0\t0\t0");
-        Serial.println("\n--------------------------------------------------------------");
-
-        Serial.println("\nYour MPU-6050 offsets:\n");
-        Serial.print("mpu.setXAccelOffset(");
-        Serial.print(ax_offset);
-        Serial.println(");");
-        Serial.print("mpu.setYAccelOffset(");
-        Serial.print(ay_offset);
-        Serial.println(");");
-        Serial.print("mpu.setZAccelOffset(");
-        Serial.print(az_offset);
-        Serial.println(");");
-        Serial.print("mpu.setXGyroOffset(");
-        Serial.print(gx_offset);
-        Serial.println(");");
-        Serial.print("mpu.setYGyroOffset(");
-        Serial.print(gy_offset);
-        Serial.println(");");
-        Serial.print("mpu.setZGyroOffset(");
-        Serial.print(gz_offset);
-        Serial.println(");");
-
-        Serial.println("\nYou can copy and paste the above offsets directly into your sketch. :)");
-
-        while (1)
-            ;
-    }
+    Serial.printf("Pass %u/%u\tbias:\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", progress->pass, progress->passes,
+                  progress->bias[0], progress->bias[1], progress->bias[2],
+                  progress->bias[3], progress->bias[4], progress->bias[5]);
 }
 
-///////////////////////////////////   FUNCTIONS   ////////////////////////////////////
-void meansensors()
+// Mean of samples readings at the offsets now in the registers; the passes
+// report the bias before their offset step, so the last one is stale
+void measureMean(float mean[6])
 {
-    long i = 0, buff_ax = 0, buff_ay = 0, buff_az = 0, buff_gx = 0, buff_gy = 0, buff_gz = 0;
-
-    while (i < (buffersize + 101))
+    int32_t sum[6] = {0, 0, 0, 0, 0, 0};
+    delay(MPU6050_CALIBRATION_SETTLE_MS); // flush samples taken at the old offsets
+    for (uint16_t n = 0; n < samples; n++)
     {
-        // read raw accel/gyro measurements from device
-        accelgyro.getMotion6(&ax, &ay, &az, &gx, &gy, &gz);
-
-        if (i > 100 && i <= (buffersize + 100))
-        { // First 100 measures are discarded
-            buff_ax = buff_ax + ax;
-            buff_ay = buff_ay + ay;
-            buff_az = buff_az + az;
-            buff_gx = buff_gx + gx;
-            buff_gy = buff_gy + gy;
-            buff_gz = buff_gz + gz;
-        }
-        if (i == (buffersize + 100))
-        {
-            mean_ax = buff_ax / buffersize;
-            mean_ay = buff_ay / buffersize;
-            mean_az = buff_az / buffersize;
-            mean_gx = buff_gx / buffersize;
-            mean_gy = buff_gy / buffersize;
-            mean_gz = buff_gz / buffersize;
-        }
-        i++;
-        delay(2); // Needed so we don't get repeated measures
+        int16_t m[6];
+        delay(1);
+        accelgyro.getMotion6(&m[0], &m[1], &m[2], &m[3], &m[4], &m[5]);
+        for (uint8_t i = 0; i < 6; i++)
+            sum[i] += m[i];
     }
+    for (uint8_t i = 0; i < 6; i++)
+        mean[i] = (float)sum[i] / samples;
 }
 
-void calibration()
+///////////////////////////////////   LOOP   ////////////////////////////////////
+void loop()
 {
-    ax_offset = -mean_ax / 8;
-    ay_offset = -mean_ay / 8;
-    az_offset = (16384 - mean_az) / 8;
-
-    gx_offset = -mean_gx / 4;
-    gy_offset = -mean_gy / 4;
-    gz_offset = -mean_gz / 4;
-    while (1)
-    {
-        int ready = 0;
-        accelgyro.setXAccelOffset(ax_offset);
-        accelgyro.setYAccelOffset(ay_offset);
-        accelgyro.setZAccelOffset(az_offset);
-
-        accelgyro.setXGyroOffset(gx_offset);
-        accelgyro.setYGyroOffset(gy_offset);
-        accelgyro.setZGyroOffset(gz_offset);
-
-        meansensors();
-        Serial.println("...");
-
-        if (abs(mean_ax) <= acel_deadzone)
-            ready++;
-        else
-            ax_offset = ax_offset - mean_ax / acel_deadzone;
-
-        if (abs(mean_ay) <= acel_deadzone)
-            ready++;
-        else
-            ay_offset = ay_offset - mean_ay / acel_deadzone;
-
-        if (abs(16384 - mean_az) <= acel_deadzone)
-            ready++;
-        else
-            az_offset = az_offset + (16384 - mean_az) / acel_deadzone;
-
-        if (abs(mean_gx) <= gyro_deadzone)
-            ready++;
-        else
-            gx_offset = gx_offset - mean_gx / (gyro_deadzone + 1);
+    Serial.println("\nCalculating offsets (acelX acelY acelZ gyroX gyroY gyroZ)");
+    unsigned long start = millis();
+    uint8_t status = accelgyro.calibrateOffsets(MPU6050_CALIBRATE_GYRO | MPU6050_CALIBRATE_ACCEL, samples, maxPasses, printPass, NULL);
+    unsigned long elapsed = millis() - start;
+    float mean[6];
+    measureMean(mean);
+
+    if (status == 2)
+        Serial.println("\nI2C errors during calibration; check the wiring and try again.");
+    else if (status == 1)
+        Serial.println("\nDid not settle within maxPasses (was the board moved?); offsets below are the last estimate.");
+
+    Serial.printf("\nFINISHED! (%lu ms)\n", elapsed);
+    Serial.println("\n==============================================================");
+    Serial.println("\nRESULTS:");
+    Serial.println("\nSensor data is listed in the format:\tacelX\tacelY\tacelZ\tgyroX\tgyroY\tgyroZ");
+    Serial.printf("\nFinal readings INCLUDING offsets:\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\n",
+                  mean[0], mean[1], mean[2], mean[3], mean[4], mean[5]);
+    Serial.println("\nCompare with IDEAL sensor readings:\t0\t0\t16384\t0\t0\t0");
+    Serial.println("\n--------------------------------------------------------------");
 
-        if (abs(mean_gy) <= gyro_deadzone)
-            ready++;
-        else
-            gy_offset = gy_offset - mean_gy / (gyro_deadzone + 1);
+    Serial.println("\nYour MPU-6050 offsets:\n");
+    Serial.printf("mpu.setXAccelOffset(%d);\n", accelgyro.getXAccelOffset());
+    Serial.printf("mpu.setYAccelOffset(%d);\n", accelgyro.getYAccelOffset());
+    Serial.printf("mpu.setZAccelOffset(%d);\n", accelgyro.getZAccelOffset());
+    Serial.printf("mpu.setXGyroOffset(%d);\n", accelgyro.getXGyroOffset());
+    Serial.printf("mpu.setYGyroOffset(%d);\n", accelgyro.getYGyroOffset());
+    Serial.printf("mpu.setZGyroOffset(%d);\n", accelgyro.getZGyroOffset());
 
-        if (abs(mean_gz) <= gyro_deadzone)
-            ready++;
-        else
-            gz_offset = gz_offset - mean_gz / (gyro_deadzone + 1);
+    Serial.println("\nYou can copy and paste the above offsets directly into your sketch,");
+    Serial.println("or send {\"command\": \"CALIBRATE\", \"accel\": true} to the robot to calibrate and store them on the board. :)");
 
-        if (ready == 6)
-            break;
-    }
-}
\ No newline at end of file
+    while (1)
+        ;
+}